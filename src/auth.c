@@ -460,6 +460,8 @@ static int add_authenticated_listener (const char *mount, mount_proxy *mountinfo
     /* some win32 setups do not do TCP win scaling well, so allow an override */
     if (mountinfo && mountinfo->so_sndbuf > 0)
         sock_set_send_buffer (client->connection.sock, mountinfo->so_sndbuf);
+    if (mountinfo && mountinfo->notsent_lowat > 0)
+        sock_set_notsent_lowat (client->connection.sock, mountinfo->notsent_lowat);
 
     /* check whether we are processing a streamlist request for slaves */
     if (strcmp (mount, "/admin/streams") == 0)
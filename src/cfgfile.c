@@ -316,6 +316,7 @@ listener_t *config_clear_listener (listener_t *listener)
         if (listener->refcount == 0)
         {
             if (listener->bind_address)     xmlFree (listener->bind_address);
+            if (listener->unix_socket)      xmlFree (listener->unix_socket);
             if (listener->shoutcast_mount)  xmlFree (listener->shoutcast_mount);
             free (listener);
         }
@@ -334,6 +335,7 @@ void config_clear(ice_config_t *c)
     xmlFree (c->server_id);
     if (c->location) xmlFree(c->location);
     if (c->admin) xmlFree(c->admin);
+    if (c->worker_cpus) xmlFree(c->worker_cpus);
     if (c->source_password) xmlFree(c->source_password);
     if (c->admin_username) xmlFree(c->admin_username);
     if (c->admin_password) xmlFree(c->admin_password);
@@ -638,6 +640,7 @@ static int _parse_accesslog (xmlNodePtr node, void *arg)
         { "querystr",       config_get_bool,    &log->qstr },
         { "size",           config_get_int,     &log->size },
         { "duration",       config_get_int,     &log->duration },
+        { "async",          config_get_bool,    &log->async },
         { NULL, NULL, NULL }
     };
 
@@ -648,6 +651,8 @@ static int _parse_accesslog (xmlNodePtr node, void *arg)
         return 2;
     if (type && strcmp (type, "CLF-ESC") == 0)
         log->type = LOG_ACCESS_CLF_ESC;
+    if (type && strcmp (type, "JSON") == 0)
+        log->type = LOG_ACCESS_JSON;
     xmlFree (type);
     return 0;
 }
@@ -664,6 +669,7 @@ static int _parse_errorlog (xmlNodePtr node, void *arg)
         { "level",          config_get_int,     &log->level },
         { "size",           config_get_int,     &log->size },
         { "duration",       config_get_int,     &log->duration },
+        { "async",          config_get_bool,    &log->async },
         { NULL, NULL, NULL }
     };
 
@@ -887,6 +893,12 @@ static int _parse_mount (xmlNodePtr node, void *arg)
         { "skip-accesslog",     config_get_bool,    &mount->skip_accesslog },
         { "charset",            config_get_str,     &mount->charset },
         { "qblock-size",        config_get_int,     &mount->queue_block_size },
+        { "coalesce-size",      config_get_int,     &mount->coalesce_size },
+        { "coalesce-latency",   config_get_int,     &mount->coalesce_latency },
+        { "listener-latency",   config_get_int,     &mount->listener_latency },
+        { "burst-duration",     config_get_int,     &mount->burst_duration },
+        { "low-latency",        config_get_bool,    &mount->low_latency },
+        { "slow-listener-skips",config_get_int,     &mount->slow_listener_skips },
         { "redirect",           config_get_str,     &mount->redirect },
         { "metadata-interval",  config_get_int,     &mount->mp3_meta_interval },
         { "mp3-metadata-interval",
@@ -898,6 +910,7 @@ static int _parse_mount (xmlNodePtr node, void *arg)
         { "no-mount",           config_get_bool,    &mount->no_mount },
         { "ban-client",         config_get_int,     &mount->ban_client },
         { "so-sndbuf",          config_get_int,     &mount->so_sndbuf },
+        { "notsent-lowat",      config_get_int,     &mount->notsent_lowat },
         { "hidden",             config_get_bool,    &mount->hidden },
         { "authentication",     auth_get_authenticator, &mount->auth },
         { "on-connect",         config_get_str,     &mount->on_connect },
@@ -926,6 +939,7 @@ static int _parse_mount (xmlNodePtr node, void *arg)
     mount->burst_size = -1;
     mount->min_queue_size = -1;
     mount->mp3_meta_interval = -1;
+    mount->listener_latency = -1;
     mount->yp_public = -1;
     mount->url_ogg_meta = 1;
     mount->source_timeout = config->source_timeout;
@@ -953,6 +967,10 @@ static int _parse_mount (xmlNodePtr node, void *arg)
         mount->min_queue_size = mount->burst_size;
     if (mount->queue_block_size < 100)
         mount->queue_block_size = 1400;
+    if (mount->coalesce_size > 30000) /* keep within iceblock framing */
+        mount->coalesce_size = 30000;
+    if (mount->coalesce_latency <= 0)
+        mount->coalesce_latency = 250;
     if (mount->ban_client < 0)
         mount->no_mount = 0;
 
@@ -1105,9 +1123,14 @@ static int _parse_limits (xmlNodePtr node, void *arg)
         { "clients",        config_get_int,    &config->client_limit },
         { "sources",        config_get_int,    &config->source_limit },
         { "queue-size",     config_get_int,    &config->queue_size_limit },
+        { "queue-memory-limit",
+                            config_get_bitrate,&config->queue_memory_limit },
         { "min-queue-size", config_get_int,    &config->min_queue_size },
+        { "kernel-pacing",  config_get_bool,   &config->kernel_pacing },
         { "burst-size",     config_get_int,    &config->burst_size },
         { "workers",        config_get_int,    &config->workers_count },
+        { "workers-max",    config_get_int,    &config->workers_max },
+        { "worker-cpus",    config_get_str,    &config->worker_cpus },
         { "client-timeout", config_get_int,    &config->client_timeout },
         { "header-timeout", config_get_int,    &config->header_timeout },
         { "source-timeout", config_get_int,    &config->source_timeout },
@@ -1117,6 +1140,8 @@ static int _parse_limits (xmlNodePtr node, void *arg)
         return -1;
     if (config->workers_count < 1)   config->workers_count = 1;
     if (config->workers_count > 400) config->workers_count = 400;
+    if (config->workers_max < config->workers_count) config->workers_max = config->workers_count;
+    if (config->workers_max > 400)   config->workers_max = 400;
     return 0;
 }
 
@@ -1155,6 +1180,7 @@ static int _parse_listen_sock (xmlNodePtr node, void *arg)
         { "port",               config_get_int,     &listener->port },
         { "shoutcast-compat",   config_get_bool,    &listener->shoutcast_compat },
         { "bind-address",       config_get_str,     &listener->bind_address },
+        { "unix-socket",        config_get_str,     &listener->unix_socket },
         { "queue-len",          config_get_int,     &listener->qlen },
         { "so-sndbuf",          config_get_int,     &listener->so_sndbuf },
         { "ssl",                config_get_bool,    &listener->ssl },
@@ -1177,6 +1203,13 @@ static int _parse_listen_sock (xmlNodePtr node, void *arg)
     config->listen_sock = listener;
     config->listen_sock_count++;
 
+    if (listener->unix_socket)
+    {
+        listener->port = 0;
+        if (listener->shoutcast_mount == NULL)
+            listener->shoutcast_mount = (char*)xmlStrdup (XMLSTR(config->shoutcast_mount));
+        return 0;
+    }
     if (listener->shoutcast_mount)
     {
         listener_t *sc_port = calloc (1, sizeof (listener_t));
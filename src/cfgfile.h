@@ -51,11 +51,13 @@ typedef struct access_log
     int display;
     int size;
     unsigned duration;
+    int async;
     char *exclude_ext;
 } access_log;
 
 #define LOG_ACCESS_CLF                  0
 #define LOG_ACCESS_CLF_ESC              1
+#define LOG_ACCESS_JSON                 2
 
 typedef struct error_log
 {
@@ -66,6 +68,7 @@ typedef struct error_log
     int size;
     unsigned duration;
     int level;
+    int async;
 } error_log;
 
 typedef struct playlist_log
@@ -120,6 +123,7 @@ typedef struct _mount_proxy {
     int no_mount; /* Do we permit direct requests of this mountpoint? (or only
                      indirect, through fallbacks) */
     int so_sndbuf;      /* TCP send buffer size for new clients */
+    int notsent_lowat;  /* limit of unsent data held by the kernel */
     int burst_size; /* amount to send to a new client if possible, -1 take
                      * from global setting */
     int min_queue_size;     /* minimum length of queue */
@@ -129,6 +133,12 @@ typedef struct _mount_proxy {
     char *charset;  /* character set if not utf8 */
     int mp3_meta_interval; /* outgoing per-stream metadata interval */
     int queue_block_size; /* for non-ogg streams, try to create blocks of this size */
+    int coalesce_size;      /* merge small queue blocks up to this size */
+    int coalesce_latency;   /* max ms a block is held back for merging */
+    int listener_latency;   /* max ms a caught up listener waits for more data */
+    int burst_duration;     /* burst in ms of media, overrides burst_size */
+    int low_latency;        /* start at latest sync point and send on arrival */
+    int slow_listener_skips; /* times a slow listener is moved on before dropping */
     int filter_theora; /* prevent theora pages getting queued */
     int url_ogg_meta; /* enable to allow updates via url requests for ogg */
     int ogg_passthrough; /* enable to prevent the ogg stream being rebuilt */
@@ -178,6 +188,7 @@ struct _listener_t
     int refcount;
     int port;
     char *bind_address;
+    char *unix_socket;      /* path of a unix domain socket, instead of the port */
     char *shoutcast_mount;
     int qlen;
     int shoutcast_compat;
@@ -233,12 +244,16 @@ typedef struct ice_config_tag
     unsigned int queue_size_limit;
     int min_queue_size;
     int workers_count;
+    int workers_max;
+    char *worker_cpus;
     unsigned int burst_size;
     int client_timeout;
     int header_timeout;
     int source_timeout;
     int ice_login;
     int64_t max_bandwidth;
+    int64_t queue_memory_limit;
+    int kernel_pacing;
     int fileserve;
     int on_demand; /* global setting for all relays */
 
@@ -23,6 +23,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <sched.h>
+#endif
 
 #include "thread/thread.h"
 #include "avl/avl.h"
@@ -48,6 +52,20 @@
 
 int worker_count;
 
+/* the CPU groups that workers are bound to, changes to the groups are picked
+ * up by the workers when the generation changes */
+static char *worker_cpu_list;
+#ifdef CPU_SET
+static cpu_set_t *worker_cpu_sets;
+#endif
+static int worker_cpu_set_count;
+static int worker_cpu_generation;
+
+/* bounds for the worker count when scaling on load, and the state for it */
+static int workers_min, workers_max;
+static uint64_t workers_sampled_us;
+static int workers_high_load, workers_low_load;
+
 void client_register (client_t *client)
 {
     if (client && client->connection.sock)
@@ -325,6 +343,30 @@ void client_set_queue (client_t *client, refbuf_t *refbuf)
 }
 
 
+/* minimum cost of a client in busy microseconds a second, so that the number
+ * of clients still counts when the workers are mostly idle
+ */
+#define WORKER_CLIENT_COST_MIN      50
+
+/* estimate the cost of a worker with extra clients added. The measured cost
+ * is adjusted by the per-client cost for the clients added or removed since
+ * it was measured.
+ */
+uint64_t worker_cost (worker_t *worker, int extra_clients)
+{
+    uint64_t per_client = WORKER_CLIENT_COST_MIN, cost = 0;
+    int count = worker->count + worker->pending_count + extra_clients;
+
+    if (worker->cost_count && worker->cost_us / worker->cost_count > per_client)
+        per_client = worker->cost_us / worker->cost_count;
+    if (worker->cost_us > per_client * worker->cost_count)
+        cost = worker->cost_us - per_client * worker->cost_count;
+    if (count > 0)
+        cost += per_client * count;
+    return cost;
+}
+
+
 worker_t *find_least_busy_handler (void)
 {
     worker_t *min = workers;
@@ -332,12 +374,19 @@ worker_t *find_least_busy_handler (void)
     if (workers && workers->next)
     {
         worker_t *handler = workers->next;
-        DEBUG2 ("handler %p has %d clients", min, min->count);
+        uint64_t min_cost = worker_cost (min, 0);
+
+        DEBUG3 ("handler %p has %d clients, cost %" PRIu64, min, min->count, min_cost);
         while (handler)
         {
-            DEBUG2 ("handler %p has %d clients", handler, handler->count);
-            if (handler->count < min->count)
+            uint64_t cost = worker_cost (handler, 0);
+
+            DEBUG3 ("handler %p has %d clients, cost %" PRIu64, handler, handler->count, cost);
+            if (cost < min_cost)
+            {
                 min = handler;
+                min_cost = cost;
+            }
             handler = handler->next;
         }
     }
@@ -345,6 +394,30 @@ worker_t *find_least_busy_handler (void)
 }
 
 
+/* as above but only for workers bound to the cpu group, leaving out the
+ * exclude worker. workers_lock held, NULL if there are no others */
+worker_t *find_least_busy_handler_in_group (int cpu_group, worker_t *exclude)
+{
+    worker_t *handler = workers, *min = NULL;
+    uint64_t min_cost = 0;
+
+    for (; handler; handler = handler->next)
+    {
+        uint64_t cost;
+
+        if (handler->cpu_group != cpu_group || handler == exclude)
+            continue;
+        cost = worker_cost (handler, 0);
+        if (min == NULL || cost < min_cost)
+        {
+            min = handler;
+            min_cost = cost;
+        }
+    }
+    return min;
+}
+
+
 /* worker mutex should be already locked */
 static void worker_add_client (worker_t *worker, client_t *client)
 {
@@ -435,6 +508,34 @@ static client_t **worker_add_pending_clients (worker_t *worker)
 }
 
 
+/* bind the calling worker thread to the CPUs of its group */
+static void worker_bind_cpus (worker_t *worker)
+{
+#ifdef CPU_SET
+    cpu_set_t set;
+
+    thread_rwlock_rlock (&workers_lock);
+    worker->cpu_generation = worker_cpu_generation;
+    if (worker->cpu_group >= 0 && worker->cpu_group < worker_cpu_set_count)
+        memcpy (&set, &worker_cpu_sets [worker->cpu_group], sizeof (set));
+    else
+    {
+        int i;
+        CPU_ZERO (&set);
+        for (i = 0; i < CPU_SETSIZE; i++)
+            CPU_SET (i, &set);
+    }
+    thread_rwlock_unlock (&workers_lock);
+    if (sched_setaffinity (0, sizeof (set), &set) < 0)
+        WARN1 ("unable to set CPUs for worker: %s", strerror (errno));
+    else if (worker->cpu_group >= 0)
+        INFO2 ("worker %p bound to CPU group %d", worker, worker->cpu_group);
+#else
+    worker->cpu_generation = worker_cpu_generation;
+#endif
+}
+
+
 static client_t **worker_wait (worker_t *worker)
 {
     int ret, duration = 2;
@@ -472,6 +573,8 @@ static client_t **worker_wait (worker_t *worker)
     worker->time_ms = timing_get_time();
     worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
 
+    if (worker->cpu_generation != worker_cpu_generation)
+        worker_bind_cpus (worker);
     return worker_add_pending_clients (worker);
 }
 
@@ -525,11 +628,16 @@ void *worker (void *arg)
     worker->running = 1;
     worker->wakeup_ms = (int64_t)0;
     worker->time_ms = timing_get_time();
+    if (worker->cpu_group >= 0)
+        worker_bind_cpus (worker);
 
     while (1)
     {
         client_t *client = *prevp;
         uint64_t sched_ms = worker->time_ms+6;
+        struct timespec start, end;
+
+        thread_get_timespec (&start);
 
         while (client)
         {
@@ -576,6 +684,9 @@ void *worker (void *arg)
             if (worker->count == 0 && worker->pending_count == 0)
                 break;
         }
+        thread_get_timespec (&end);
+        if (THREAD_TIME_US (&end) > THREAD_TIME_US (&start))
+            worker->busy_us += THREAD_TIME_US (&end) - THREAD_TIME_US (&start);
         prevp = worker_wait (worker);
     }
     worker_relocate_clients (worker);
@@ -594,6 +705,8 @@ static void worker_start (void)
     thread_spin_create (&handler->lock);
     thread_rwlock_wlock (&workers_lock);
     handler->last_p = &handler->clients;
+    handler->cpu_group = worker_cpu_set_count ? worker_count % worker_cpu_set_count : -1;
+    handler->cpu_generation = worker_cpu_generation;
     handler->next = workers;
     workers = handler;
     worker_count++;
@@ -636,6 +749,174 @@ void workers_adjust (int new_count)
     }
 }
 
+/* set the range of workers, if max_count is above min_count then the number
+ * of workers is changed within the range according to the load.
+ */
+void workers_set_range (int min_count, int max_count)
+{
+    workers_min = min_count;
+    workers_max = max_count > min_count ? max_count : min_count;
+    workers_high_load = workers_low_load = 0;
+    if (worker_count < workers_min)
+        workers_adjust (workers_min);
+    else if (worker_count > workers_max)
+        workers_adjust (workers_max);
+    else
+        INFO3 ("worker count %d, range %d to %d", worker_count, workers_min, workers_max);
+}
+
+
+/* called periodically to measure how busy the workers are. The cost of each
+ * worker is kept as a weighted average for placing clients. A worker is added
+ * if the workers stay busy, and one is dropped if the rest would still be
+ * lightly loaded without it, the clients being relocated to another worker.
+ */
+void workers_check_load (void)
+{
+    struct timespec now;
+    uint64_t now_us, busy_us = 0, max_us = 0, elapsed_us;
+    worker_t *handler;
+    int load, max_load, count, valid, len = 0;
+    char *loads;
+
+    thread_get_timespec (&now);
+    now_us = THREAD_TIME_US (&now);
+    if (now_us < workers_sampled_us + 5000000)
+        return;
+    elapsed_us = now_us - workers_sampled_us;
+    /* skip the first sample or one too stale to use */
+    valid = (workers_sampled_us && elapsed_us <= 60000000);
+    workers_sampled_us = now_us;
+
+    thread_rwlock_rlock (&workers_lock);
+    loads = malloc (worker_count * 24 + 1);
+    for (handler = workers; handler; handler = handler->next)
+    {
+        uint64_t us = handler->busy_us, diff = us - handler->busy_us_sampled;
+
+        handler->busy_us_sampled = us;
+        if (valid == 0)
+            continue;
+        busy_us += diff;
+        if (diff > max_us)
+            max_us = diff;
+        diff = diff * 1000000 / elapsed_us;
+        handler->cost_us = (handler->cost_us + diff) / 2;
+        handler->cost_count = handler->count;
+        if (loads)
+            len += snprintf (loads + len, 24, "%s%d:%.1f", len ? "," : "",
+                    handler->count, handler->cost_us / 10000.0);
+    }
+    count = worker_count;
+    thread_rwlock_unlock (&workers_lock);
+
+    if (valid && loads)
+        stats_event_flags (NULL, "worker_load", loads, STATS_COUNTERS|STATS_HIDDEN);
+    free (loads);
+    if (valid == 0 || count == 0)
+        return;
+    load = (int)(busy_us * 100 / (elapsed_us * count));
+    max_load = (int)(max_us * 100 / elapsed_us);
+    DEBUG3 ("%d workers, average load %d%%, busiest %d%%", count, load, max_load);
+
+    if (workers_max <= workers_min)
+        return;
+    /* listeners stay with their source worker, so a single busy worker is not
+     * helped by more workers, only the average load is used for scaling */
+    if (load > 70 && count < workers_max)
+    {
+        workers_low_load = 0;
+        if (++workers_high_load < 3)
+            return;
+        INFO2 ("workers average load %d%%, increasing to %d", load, count+1);
+        workers_adjust (count+1);
+    }
+    else if (count > workers_min && load * count / (count-1) < 35)
+    {
+        workers_high_load = 0;
+        if (++workers_low_load < 6)
+            return;
+        INFO2 ("workers average load %d%%, reducing to %d", load, count-1);
+        workers_adjust (count-1);
+    }
+    workers_high_load = workers_low_load = 0;
+}
+
+
+/* set the CPUs that workers run on. The list is of groups separated by ';',
+ * each a comma separated list of CPUs or ranges of them, eg "0-7;8-15" for
+ * two NUMA nodes. Workers are placed in the groups in turn.
+ */
+void workers_set_cpus (const char *list)
+{
+    worker_t *handler;
+    int i;
+
+    if (list == worker_cpu_list || (list && worker_cpu_list && strcmp (list, worker_cpu_list) == 0))
+        return;
+#ifdef CPU_SET
+    {
+        cpu_set_t *sets = NULL;
+        const char *p = list;
+        int count = 0;
+
+        while (p && *p)
+        {
+            cpu_set_t *tmp = realloc (sets, (count+1) * sizeof (cpu_set_t));
+            int first, last, n;
+
+            if (tmp == NULL)
+                break;
+            sets = tmp;
+            CPU_ZERO (&sets [count]);
+            while (*p && *p != ';')
+            {
+                if (sscanf (p, "%d%n", &first, &n) < 1)
+                    break;
+                p += n;
+                last = first;
+                if (*p == '-' && sscanf (p+1, "%d%n", &last, &n) == 1)
+                    p += n+1;
+                for (; first <= last && first < CPU_SETSIZE; first++)
+                    if (first >= 0)
+                        CPU_SET (first, &sets [count]);
+                while (*p == ',' || *p == ' ')
+                    p++;
+            }
+            if (CPU_COUNT (&sets [count]))
+                count++;
+            if (*p == ';')
+                p++;
+            else if (*p)
+            {
+                WARN1 ("unable to parse worker-cpus at \"%s\"", p);
+                break;
+            }
+        }
+        thread_rwlock_wlock (&workers_lock);
+        free (worker_cpu_sets);
+        worker_cpu_sets = sets;
+        worker_cpu_set_count = count;
+    }
+#else
+    if (list)
+        WARN0 ("worker-cpus is not supported on this platform");
+    thread_rwlock_wlock (&workers_lock);
+#endif
+    free (worker_cpu_list);
+    worker_cpu_list = list ? strdup (list) : NULL;
+    worker_cpu_generation++;
+    /* the oldest worker is at the end of the list */
+    for (handler = workers, i = worker_count; handler; handler = handler->next)
+    {
+        i--;
+        handler->cpu_group = worker_cpu_set_count ? i % worker_cpu_set_count : -1;
+        worker_wakeup (handler);
+    }
+    thread_rwlock_unlock (&workers_lock);
+}
+
+
 void worker_wakeup (worker_t *worker)
 {
     pipe_write (worker->wakeup_fd[1], "W", 1);
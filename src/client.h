@@ -43,6 +43,12 @@ struct _worker_t
     struct timespec current_time;
     uint64_t time_ms;
     uint64_t wakeup_ms;
+    int cpu_group;          /* index into worker-cpus groups, -1 if not bound */
+    int cpu_generation;
+    uint64_t busy_us;       /* time spent processing clients */
+    uint64_t busy_us_sampled;
+    uint64_t cost_us;       /* weighted average of busy microseconds a second */
+    int cost_count;         /* number of clients when cost was measured */
     struct _worker_t *next;
 };
 
@@ -119,6 +125,14 @@ struct _client_tag
 
     /* http response code for this client */
     int respcode;
+
+    /* times a slow listener has been moved forward on the queue */
+    unsigned int skips;
+    time_t skip_expire;     /* drop if a pending skip has not happened by then */
+
+    /* last sample of data held in the kernel for sending */
+    int unsent;
+    time_t unsent_check;
 };
 
 void client_register (client_t *client);
@@ -139,7 +153,12 @@ int  client_compare (void *compare_arg, void *a, void *b);
 int  client_change_worker (client_t *client, worker_t *dest_worker);
 void client_add_worker (client_t *client);
 worker_t *find_least_busy_handler (void);
+worker_t *find_least_busy_handler_in_group (int cpu_group, worker_t *exclude);
+uint64_t worker_cost (worker_t *worker, int extra_clients);
 void workers_adjust (int new_count);
+void workers_set_range (int min_count, int max_count);
+void workers_check_load (void);
+void workers_set_cpus (const char *list);
 void worker_wakeup (worker_t *worker);
 
 
@@ -155,6 +174,10 @@ void worker_wakeup (worker_t *worker);
 #define CLIENT_IP_BAN_LIFT          (1<<8)
 #define CLIENT_META_INSTREAM        (1<<9)
 #define CLIENT_HIJACKER             (1<<10)
+#define CLIENT_RESUME_CHECKED       (1<<11)
+#define CLIENT_KERNEL_PACED         (1<<12)
+#define CLIENT_SKIP_PENDING         (1<<13)
+#define CLIENT_FILE_LOAD            (1<<14)
 #define CLIENT_FORMAT_BIT           (1<<16)
 
 #endif  /* __CLIENT_H__ */
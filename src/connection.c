@@ -1512,7 +1512,8 @@ void connection_listen_sockets_close (ice_config_t *config, int all_sockets)
         {
             // close all listening sockets unless privileged ones are to stay open
             // and it is still present in the config.
-            if (config && all_sockets == 0 && global.server_conn [old]->port < 1024)
+            if (config && all_sockets == 0 && global.server_conn [old]->port < 1024 &&
+                    global.server_conn [old]->unix_socket == NULL)
             {
                 listener_t *listener = config->listen_sock;
                 while (listener && listener->port != global.server_conn [old]->port)
@@ -1530,7 +1531,13 @@ void connection_listen_sockets_close (ice_config_t *config, int all_sockets)
                     continue;
                 }
             }
-            INFO1 ("Closing port %d", global.server_conn [old]->port);
+            if (global.server_conn [old]->unix_socket)
+            {
+                INFO1 ("Closing unix socket %s", global.server_conn [old]->unix_socket);
+                unlink (global.server_conn [old]->unix_socket);
+            }
+            else
+                INFO1 ("Closing port %d", global.server_conn [old]->port);
             sock_close (global.serversock [old]);
             global.serversock [old] = SOCK_ERROR;
             config_clear_listener (global.server_conn [old]);
@@ -1572,7 +1579,12 @@ int connection_setup_sockets (ice_config_t *config)
 
         do
         {
-            sock_t sock = sock_get_server_socket (listener->port, listener->bind_address);
+            sock_t sock;
+
+            if (listener->unix_socket)
+                sock = sock_get_unix_server_socket (listener->unix_socket);
+            else
+                sock = sock_get_server_socket (listener->port, listener->bind_address);
             if (sock == SOCK_ERROR)
                 break;
             if (sock_listen (sock, listener->qlen) == SOCK_ERROR)
@@ -1594,7 +1606,9 @@ int connection_setup_sockets (ice_config_t *config)
         } while(0);
         if (successful == 0)
         {
-            if (listener->bind_address)
+            if (listener->unix_socket)
+                ERROR1 ("Could not create listener socket at %s", listener->unix_socket);
+            else if (listener->bind_address)
                 ERROR2 ("Could not create listener socket on port %d bind %s",
                         listener->port, listener->bind_address);
             else
@@ -1604,7 +1618,9 @@ int connection_setup_sockets (ice_config_t *config)
             listener = *prev;
             continue;
         }
-        if (listener->bind_address)
+        if (listener->unix_socket)
+            INFO1 ("listener socket at %s", listener->unix_socket);
+        else if (listener->bind_address)
             INFO2 ("listener socket on port %d address %s", listener->port, listener->bind_address);
         else
             INFO1 ("listener socket on port %d", listener->port);
@@ -33,13 +33,19 @@ void event_config_read (void)
     int ret;
     ice_config_t *config;
     ice_config_t new_config, old_config;
+    char *filename;
     /* reread config file */
 
     INFO0("Re-reading XML");
-    config = config_grab_config(); /* Both to get the lock, and to be able
-                                     to find out the config filename */
-    xmlSetGenericErrorFunc (config->config_filename, log_parse_failure);
-    ret = config_parse_file(config->config_filename, &new_config);
+    config = config_get_config();
+    filename = strdup (config->config_filename);
+    config_release_config();
+
+    /* the parsing is done without the config lock held, so that lookups
+     * are only held up for the swap of the config */
+    xmlSetGenericErrorFunc (filename, log_parse_failure);
+    ret = config_parse_file (filename, &new_config);
+    xmlSetGenericErrorFunc ("", log_parse_failure);
     if(ret < 0) {
         ERROR0("Error parsing config, not replacing existing config");
         switch(ret) {
@@ -47,19 +53,18 @@ void event_config_read (void)
                 ERROR0("Config filename null or blank");
                 break;
             case CONFIG_ENOROOT:
-                ERROR1("Root element not found in %s", config->config_filename);
+                ERROR1("Root element not found in %s", filename);
                 break;
             case CONFIG_EBADROOT:
-                ERROR1("Not an icecast2 config file: %s",
-                        config->config_filename);
+                ERROR1("Not an icecast2 config file: %s", filename);
                 break;
             default:
-                ERROR1("Parse error in reading %s", config->config_filename);
+                ERROR1("Parse error in reading %s", filename);
                 break;
         }
-        config_release_config();
     }
     else {
+        config_grab_config();
         restart_logging (&new_config);
         config_set_config (&new_config, &old_config);
         config_release_config();
@@ -70,7 +75,8 @@ void event_config_read (void)
         yp_recheck_config (config);
         fserve_recheck_mime_types (config);
         stats_global (config);
-        workers_adjust (config->workers_count);
+        workers_set_cpus (config->worker_cpus);
+        workers_set_range (config->workers_count, config->workers_max);
         connection_listen_sockets_close (config, 0);
         redirector_setup (config);
         config_release_config();
@@ -78,5 +84,6 @@ void event_config_read (void)
         slave_restart();
         config_clear (&old_config);
     }
+    free (filename);
 }
 
@@ -255,11 +255,20 @@ int flv_write_metadata (struct flv *flv, refbuf_t *scmeta, const char *mount)
         }
         flv_meta_append_string (flvmeta, NULL, NULL);
         flvm = (struct flvmeta *)flvmeta->data;
-        meta_copied  = flvm->meta_pos - sizeof (*flvm);
+        if (scmeta)
+        {
+            /* keep it with the shoutcast metadata block so that other
+             * listeners of the stream can use it as it is. */
+            scmeta->associated = flvmeta;
+        }
+        else
+            meta_copied  = flvm->meta_pos - sizeof (*flvm);
         if (meta_copied + 15 + flv->mpeg_sync.raw_offset > raw->len)
         {
             int newlen = meta_copied + flv->mpeg_sync.raw_offset + 1024;
             void *p = realloc (raw->data, newlen);
+            if (meta_copied)
+                refbuf_release (flvmeta);
             if (p == NULL) return -1;
             raw->data = p;
             raw->len = newlen;
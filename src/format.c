@@ -178,6 +178,40 @@ int format_file_read (client_t *client, format_plugin_t *plugin, FILE *fp)
 }
 
 
+/* read the whole of a file into a chain of blocks, aligned in the same way
+ * as format_file_read, so it can be shared between clients. The alignment
+ * state is kept with the local client so the plugin state is not touched.
+ */
+refbuf_t *format_file_load (format_plugin_t *plugin, FILE *fp)
+{
+    refbuf_t *head = NULL, **tail = &head;
+    client_t client;
+
+    memset (&client, 0, sizeof (client));
+    client.flags = CLIENT_FILE_LOAD;
+    while (1)
+    {
+        refbuf_t *refbuf = refbuf_new (4096);
+
+        client.refbuf = refbuf;
+        client.pos = refbuf->len;
+        if (format_file_read (&client, plugin, fp) < 0)
+        {
+            refbuf_release (refbuf);
+            break;
+        }
+        *tail = refbuf;
+        tail = &refbuf->next;
+    }
+    if (plugin->align_buffer && client.format_data)
+    {
+        client.refbuf = NULL;
+        plugin->align_buffer (&client, plugin);  /* drop the alignment state */
+    }
+    return head;
+}
+
+
 int format_generic_write_to_client (client_t *client)
 {
     refbuf_t *refbuf = client->refbuf;
@@ -71,6 +71,7 @@ int format_get_plugin (format_plugin_t *plugin, client_t *client);
 int format_generic_write_to_client (client_t *client);
 
 int format_file_read (client_t *client, format_plugin_t *plugin, FILE *fp);
+refbuf_t *format_file_load (format_plugin_t *plugin, FILE *fp);
 int format_general_headers (format_plugin_t *plugin, client_t *client);
 
 void format_send_general_headers(format_plugin_t *format, 
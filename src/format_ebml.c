@@ -39,6 +39,7 @@
 #define EBML_DEBUG 0
 #define EBML_HEADER_MAX_SIZE 131072
 #define EBML_SLICE_SIZE 4096
+#define EBML_BUFFER_SIZE (EBML_SLICE_SIZE*2)
 
 #define EBML_CLUSTER_BYTE1 0x1F
 #define EBML_CLUSTER_BYTE2 0x43
@@ -61,6 +62,7 @@ struct ebml_st {
     uint64_t position;
     uint64_t read_position;
     int buffer_position;
+    int buffer_read;
     uint64_t cluster_position;
 
     int header_read;
@@ -69,13 +71,10 @@ struct ebml_st {
     int header_position;
     int header_read_position;
 
-    unsigned char *input_buffer;
     unsigned char *buffer;
     unsigned char *header;
 
-    uint64_t found;
-    uint64_t matched_byte_num;
-    unsigned char match_byte;
+    int match_len;
 
     int last_was_cluster_end;
     int this_was_cluster_start;
@@ -97,8 +96,7 @@ static int ebml_last_was_sync(ebml_t *ebml);
 static char *ebml_write_buffer(ebml_t *ebml, int len);
 static int ebml_wrote(ebml_t *ebml, int len);
 static void ebml_debug(ebml_t *ebml);
-static unsigned char ebml_get_next_match_byte(unsigned char match_byte, uint64_t position,
-                                              uint64_t *matched_byte_num, uint64_t *found);
+static int ebml_find_cluster(ebml_t *ebml, unsigned char *data, int len, int first, uint64_t *found);
 
 int format_ebml_get_plugin (format_plugin_t *plugin, client_t *client)
 {
@@ -137,13 +135,10 @@ static int send_ebml_header (client_t *client)
 {
 
     ebml_client_data_t *ebml_client_data = client->format_data;
-    int len = EBML_SLICE_SIZE;
+    int len = ebml_client_data->header->len - ebml_client_data->header_pos;
     int ret;
 
-    if (ebml_client_data->header->len - ebml_client_data->header_pos < len) 
-    {
-        len = ebml_client_data->header->len - ebml_client_data->header_pos;
-    }
+    /* the header is shared, so send as much as the socket takes */
     ret = client_send_bytes (client, 
                              ebml_client_data->header->data + ebml_client_data->header_pos,
                              len);
@@ -193,7 +188,8 @@ static refbuf_t *ebml_get_buffer (source_t *source)
         if ((bytes = ebml_read_space(ebml_source_state->ebml)) > 0)
         {
             refbuf = refbuf_new(bytes);
-            ebml_read(ebml_source_state->ebml, refbuf->data, bytes);
+            /* the read stops short at a cluster start */
+            refbuf->len = ebml_read(ebml_source_state->ebml, refbuf->data, bytes);
 
             if (ebml_source_state->header == NULL)
             {
@@ -265,7 +261,7 @@ static void ebml_free_client_data (client_t *client)
 static void ebml_write_buf_to_file_fail (source_t *source)
 {
     WARN0 ("Write to dump file failed, disabling");
-    fclose (source->dumpfile);
+    dumpfile_close (source->dumpfile);
     source->dumpfile = NULL;
 }
 
@@ -277,15 +273,15 @@ static void ebml_write_buf_to_file (source_t *source, refbuf_t *refbuf)
 
     if (ebml_source_state->file_headers_written == 0)
     {
-        if (fwrite (ebml_source_state->header->data, 1,
-                    ebml_source_state->header->len, 
-                    source->dumpfile) != ebml_source_state->header->len)
+        if (dumpfile_write (source->dumpfile, ebml_source_state->header) < 0)
+        {
             ebml_write_buf_to_file_fail(source);
-        else
-            ebml_source_state->file_headers_written = 1;
+            return;
+        }
+        ebml_source_state->file_headers_written = 1;
     }
 
-    if (fwrite (refbuf->data, 1, refbuf->len, source->dumpfile) != refbuf->len)
+    if (dumpfile_write (source->dumpfile, refbuf) < 0)
     {
         ebml_write_buf_to_file_fail(source);
     }
@@ -310,48 +306,67 @@ static void ebml_debug(ebml_t *ebml) {
 }
 
 
-static unsigned char ebml_get_next_match_byte(unsigned char match_byte, uint64_t position, 
-                                              uint64_t *matched_byte_num, uint64_t *found) {
+/* look for a cluster ID in the data just written, which starts at stream
+ * offset ebml->position. memchr is used to skip to each possible first byte,
+ * a partial ID at the end is remembered so it can be completed by the next
+ * write. The stream offset of the first or last cluster is stored in found.
+ */
+static int ebml_find_cluster(ebml_t *ebml, unsigned char *data, int len, int first, uint64_t *found) {
+
+    int ret = 0, i = 0;
 
-    if (found != NULL) {
-        *found = 0;
-    }
+    if (ebml->match_len) {
+        int need = 4 - ebml->match_len;
+        int avail = need < len ? need : len;
 
-    if (matched_byte_num != NULL) {
-        if (match_byte == EBML_CLUSTER_BYTE1) {
-            if (matched_byte_num != NULL) {
-                *matched_byte_num = position;
+        if (memcmp(data, ebml->cluster_mark + ebml->match_len, avail) == 0) {
+            if (avail < need) {
+                ebml->match_len += avail;
+                return 0;
             }
-            return EBML_CLUSTER_BYTE2;
+            *found = ebml->position - ebml->match_len;
+            ret = 1;
+            i = need;
         }
-
-        if ((*matched_byte_num == position - 1) && (match_byte == EBML_CLUSTER_BYTE2)) {
-            return EBML_CLUSTER_BYTE3;
+        ebml->match_len = 0;
+        if (ret && first) {
+            return 1;
         }
+    }
 
-        if ((*matched_byte_num == position - 2) && (match_byte == EBML_CLUSTER_BYTE3)) {
-            return EBML_CLUSTER_BYTE4;
-        }
+    while (i < len) {
+        unsigned char *p = memchr(data + i, EBML_CLUSTER_BYTE1, len - i);
+        int avail;
 
-        if ((*matched_byte_num == position - 3) && (match_byte == EBML_CLUSTER_BYTE4)) {
-            if (found != NULL) {
-                *found = *matched_byte_num;
+        if (p == NULL) {
+            break;
+        }
+        i = p - data;
+        avail = len - i;
+        if (avail < 4) {
+            if (memcmp(p, ebml->cluster_mark, avail) == 0) {
+                ebml->match_len = avail;
+                break;
             }
-            *matched_byte_num = 0;
-            return EBML_CLUSTER_BYTE1;
+        } else if (memcmp(p, ebml->cluster_mark, 4) == 0) {
+            *found = ebml->position + i;
+            ret = 1;
+            if (first) {
+                break;
+            }
+            i += 4;
+            continue;
         }
-
-        *matched_byte_num = 0;
+        i++;
     }
 
-    return EBML_CLUSTER_BYTE1;
+    return ret;
 
 }
 
 static void ebml_destroy(ebml_t *ebml) {
 
     free(ebml->header);
-    free(ebml->input_buffer);
     free(ebml->buffer);
     free(ebml);
 
@@ -362,8 +377,7 @@ static ebml_t *ebml_create() {
     ebml_t *ebml = calloc(1, sizeof(ebml_t));
 
     ebml->header = calloc(1, EBML_HEADER_MAX_SIZE);
-    ebml->buffer = calloc(1, EBML_SLICE_SIZE);
-    ebml->input_buffer = calloc(1, EBML_SLICE_SIZE);
+    ebml->buffer = calloc(1, EBML_BUFFER_SIZE);
 
     ebml->cluster_mark[0] = EBML_CLUSTER_BYTE1;
     ebml->cluster_mark[1] = EBML_CLUSTER_BYTE2;
@@ -432,10 +446,9 @@ static int ebml_read(ebml_t *ebml, char *buffer, int len) {
             }
         }
 
-        memcpy(buffer, ebml->buffer, to_read);
+        memcpy(buffer, ebml->buffer + ebml->buffer_read, to_read);
         ebml->read_position += to_read;
-        memmove(ebml->buffer, ebml->buffer + to_read, ebml->buffer_position - to_read);
-        ebml->buffer_position -= to_read;
+        ebml->buffer_read += to_read;
 
     } else {
         if (ebml->header_size != 0) {
@@ -481,68 +494,67 @@ static int ebml_last_was_sync(ebml_t *ebml) {
 
 }
 
+/* data is read in after whatever is still waiting in the buffer, that is
+ * normally nothing as the reader takes all it can before asking for more
+ */
 static char *ebml_write_buffer(ebml_t *ebml, int len) {
 
-    return (char *)ebml->input_buffer;
+    if (ebml->buffer_read == ebml->buffer_position) {
+        ebml->buffer_read = ebml->buffer_position = 0;
+    } else if (ebml->buffer_position + len > EBML_BUFFER_SIZE) {
+        memmove(ebml->buffer, ebml->buffer + ebml->buffer_read,
+                ebml->buffer_position - ebml->buffer_read);
+        ebml->buffer_position -= ebml->buffer_read;
+        ebml->buffer_read = 0;
+    }
+    return (char *)ebml->buffer + ebml->buffer_position;
 
 }
 
 
 static int ebml_wrote(ebml_t *ebml, int len) {
 
-    int b;
-
-    for (b = 0; b < len; b++) {
-        if ((ebml->input_buffer[b] == ebml->match_byte) || (ebml->matched_byte_num > 0)) {
-            ebml->match_byte = ebml_get_next_match_byte(ebml->input_buffer[b],
-                                                        ebml->position + b,
-                                                        &ebml->matched_byte_num,
-                                                        &ebml->found);
-            if (ebml->found > 0) {
-                if (ebml->header_size == 0) {
-                    if (b > 0) {
-                        if ((ebml->header_position + b) > EBML_HEADER_MAX_SIZE) {
-                            ERROR0("EBML Header to large, failing");
-                            return -1;
-                        }
-                        memcpy(ebml->header + ebml->header_position, ebml->input_buffer, b);
-                        ebml->header_position += b;
-                    }
-                    ebml->header_size = (ebml->header_position - 4) + 1;
-                    if (EBML_DEBUG) {
-                        printf("EBML: Got header %d bytes\n", ebml->header_size);
-                    }
-                    /* first cluster */
-                    memcpy(ebml->buffer, ebml->cluster_mark, 4);
-                    ebml->buffer_position += 4;
-                    if ((b + 1) < len) {
-                        if ((ebml->buffer_position + (len - (b + 1))) > EBML_SLICE_SIZE) {
-                            ERROR0("EBML Overflow, failing");
-                            return -1;
-                        }
-                        memcpy(ebml->buffer + ebml->buffer_position, 
-                               ebml->input_buffer + (b + 1),
-                               len - (b + 1));
-                        ebml->buffer_position += len - (b + 1);
-                    }
-                    if (EBML_DEBUG) {
-                        printf("EBML: Found first cluster starting at offset: %zu\n",
-                               ebml->found);
-                    }
-                    ebml->cluster_position = ebml->found;
-                    ebml->position += len;
-                    return len;
+    unsigned char *data = ebml->buffer + ebml->buffer_position;
+    uint64_t found;
 
-                }
-                if (EBML_DEBUG) {
-                    printf("EBML: Found cluster starting at offset: %zu\n", ebml->found);
-                }
-                ebml->cluster_position = ebml->found;
-            }
-        }
+    if ((ebml->buffer_position + len) > EBML_BUFFER_SIZE) {
+        ERROR0("EBML Overflow, failing");
+        return -1;
     }
 
     if (ebml->header_size == 0) {
+        if (ebml_find_cluster(ebml, data, len, 1, &found)) {
+            /* negative if part of the cluster ID was in the previous write */
+            int b = (int)(found - ebml->position);
+
+            if ((ebml->header_position + b) > EBML_HEADER_MAX_SIZE) {
+                ERROR0("EBML Header to large, failing");
+                return -1;
+            }
+            if (b > 0) {
+                memcpy(ebml->header + ebml->header_position, data, b);
+            }
+            ebml->header_position += b;
+            ebml->header_size = ebml->header_position;
+            if (EBML_DEBUG) {
+                printf("EBML: Got header %d bytes\n", ebml->header_size);
+            }
+            /* first cluster, leave it in the buffer */
+            if (b < 0) {
+                memmove(data - b, data, len);
+                memcpy(data, ebml->cluster_mark, -b);
+                ebml->buffer_position += len - b;
+            } else {
+                ebml->buffer_read = ebml->buffer_position + b;
+                ebml->buffer_position += len;
+            }
+            if (EBML_DEBUG) {
+                printf("EBML: Found first cluster starting at offset: %zu\n", found);
+            }
+            ebml->cluster_position = found;
+            ebml->position += len;
+            return len;
+        }
         if ((ebml->header_position + len) > EBML_HEADER_MAX_SIZE) {
             ERROR0("EBML Header to large, failing");
             return -1;
@@ -551,14 +563,15 @@ static int ebml_wrote(ebml_t *ebml, int len) {
             printf("EBML: Adding to header, ofset is %d size is %d adding %d\n", 
                    ebml->header_size, ebml->header_position, len);
         }
-        memcpy(ebml->header + ebml->header_position, ebml->input_buffer, len);
+        memcpy(ebml->header + ebml->header_position, data, len);
         ebml->header_position += len;
     } else {
-        if ((ebml->buffer_position + len) > EBML_SLICE_SIZE) {
-            ERROR0("EBML Overflow, failing");
-            return -1;
+        if (ebml_find_cluster(ebml, data, len, 0, &found)) {
+            if (EBML_DEBUG) {
+                printf("EBML: Found cluster starting at offset: %zu\n", found);
+            }
+            ebml->cluster_position = found;
         }
-        memcpy(ebml->buffer + ebml->buffer_position, ebml->input_buffer, len);
         ebml->buffer_position += len;
     }
 
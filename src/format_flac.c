@@ -111,6 +111,8 @@ ogg_codec_t *initial_flac_page (format_plugin_t *plugin, ogg_page *page)
 
         parse += 4;
         stats_event_args (ogg_info->mount, "FLAC_version", "%d.%d",  parse[0], parse[1]);
+        /* sample rate is in the STREAMINFO block following the mapping header */
+        codec->granule_rate = (packet.packet[27] << 12) | (packet.packet[28] << 4) | (packet.packet[29] >> 4);
         codec->process_page = process_flac_page;
         codec->codec_free = flac_codec_free;
         codec->headers = 1;
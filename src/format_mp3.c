@@ -50,6 +50,10 @@
  */
 #define ICY_METADATA_INTERVAL 16000
 
+/* limits on how much queued data a plain listener is sent in one writev */
+#define MP3_GATHER_BLOCKS       8
+#define MP3_GATHER_BYTES        16384
+
 static void format_mp3_free_plugin(format_plugin_t *plugin, client_t *client);
 static refbuf_t *mp3_get_filter_meta (source_t *source);
 static refbuf_t *mp3_get_no_meta (source_t *source);
@@ -70,7 +74,7 @@ static void swap_client (client_t *new_client, client_t *old_client);
 #define CLIENT_IN_METADATA              (CLIENT_INTERNAL_FORMAT)
 #define CLIENT_USING_BLANK_META         (CLIENT_INTERNAL_FORMAT<<1)
 
-static refbuf_t blank_meta = { 0, 1, NULL, NULL, "\001StreamTitle='';", 17 };
+static refbuf_t blank_meta = { 0, 1, NULL, NULL, "\001StreamTitle='';", 17, 0 };
 
 
 int format_mp3_get_plugin (format_plugin_t *plugin, client_t *client)
@@ -513,6 +517,64 @@ static int send_icy_metadata (client_t *client, refbuf_t *refbuf)
 }
 
 
+/* for listeners that want the stream as is, a lagging listener can be sent
+ * several of the following queue blocks in the one writev instead of one
+ * block per call. client refbuf/pos are moved on by the amount written. A
+ * listener due to skip ahead is only sent the rest of the current block.
+ */
+static int send_queued_blocks (client_t *client)
+{
+    refbuf_t *refbuf = client->refbuf;
+    struct connection_bufs bufs;
+    int ret, blocks = 0;
+
+    connection_bufs_init (&bufs, MP3_GATHER_BLOCKS);
+    connection_bufs_append (&bufs, refbuf->data + client->pos, refbuf->len - client->pos);
+    while (bufs.total < MP3_GATHER_BYTES && blocks < MP3_GATHER_BLOCKS &&
+            (client->flags & CLIENT_SKIP_PENDING) == 0)
+    {
+        refbuf = refbuf->next;
+        if (refbuf == NULL || (refbuf->flags & SOURCE_QUEUE_BLOCK) == 0)
+            break;
+        if (bufs.total + refbuf->len > MP3_GATHER_BYTES)
+        {
+            connection_bufs_append (&bufs, refbuf->data, MP3_GATHER_BYTES - bufs.total);
+            break;
+        }
+        connection_bufs_append (&bufs, refbuf->data, refbuf->len);
+        blocks++;
+    }
+    ret = connection_bufs_send (&client->connection, &bufs, 0);
+    if (ret < bufs.total)
+        client->schedule_ms += 50;
+    connection_bufs_release (&bufs);
+
+    if (ret > 0)
+    {
+        int remaining = ret;
+
+        client->queue_pos += ret;
+        client->counter += ret;
+        while (1)
+        {
+            refbuf = client->refbuf;
+            if (remaining < (int)(refbuf->len - client->pos))
+            {
+                client->pos += remaining;
+                break;
+            }
+            remaining -= (refbuf->len - client->pos);
+            client->pos = refbuf->len;
+            if (remaining == 0)
+                break;  /* leave any move to the next block to the caller */
+            client_set_queue (client, refbuf->next);
+        }
+    }
+    client->schedule_ms += 4;
+    return ret;
+}
+
+
 /* Handler for writing mp3 data to a client, taking into account whether
  * client has requested shoutcast style metadata updates
  */
@@ -522,6 +584,10 @@ static int format_mp3_write_buf_to_client (client_t *client)
     mp3_client_data *client_mp3 = client->format_data;
     refbuf_t *refbuf = client->refbuf;
 
+    if (client_mp3->interval == 0 && (refbuf->flags & SOURCE_QUEUE_BLOCK) &&
+            refbuf->next && client->pos < refbuf->len)
+        return send_queued_blocks (client);
+
     if (client_mp3->interval && client_mp3->interval == client_mp3->since_meta_block)
         return send_icy_metadata (client, refbuf);
 
@@ -638,7 +704,9 @@ static void format_mp3_free_plugin (format_plugin_t *plugin, client_t *client)
 /* This does the actual reading, making sure the read data is packaged in
  * blocks of 1400 bytes (near the common MTU size). This is because many
  * incoming streams come in small packets which could waste a lot of 
- * bandwidth with many listeners due to headers and such like.
+ * bandwidth with many listeners due to headers and such like. With inline
+ * metadata the read stops at the metadata block so that only audio data
+ * ends up in the block.
  */
 static int complete_read (source_t *source)
 {
@@ -660,11 +728,17 @@ static int complete_read (source_t *source)
     {
         char *buf = source_mp3->read_data->data + source_mp3->read_count;
         int read_in = source_mp3->read_data->len - source_mp3->read_count;
-        int bytes = client_read_bytes (client, buf, read_in);
+        int bytes;
+
+        if (source_mp3->inline_metadata_interval > 0 &&
+                read_in > source_mp3->inline_metadata_interval - source_mp3->offset)
+            read_in = source_mp3->inline_metadata_interval - source_mp3->offset;
+        bytes = client_read_bytes (client, buf, read_in);
         if (bytes > 0)
         {
             rate_add (format->in_bitrate, bytes, client->worker->current_time.tv_sec);
             source_mp3->read_count += bytes;
+            source_mp3->offset += bytes;
             format->read_bytes += bytes;
         }
     }
@@ -680,6 +754,26 @@ int mpeg_process_buffer (client_t *client, format_plugin_t *plugin)
     mp3_state *source_mp3 = plugin->_state;
     int unprocessed = -1;
 
+    if (client->flags & CLIENT_FILE_LOAD)
+    {
+        /* loading a file without the source lock, so use separate frame
+         * state, which is freed when called without a block at the end */
+        mpeg_sync *mpsync = client->format_data;
+
+        if (refbuf == NULL)
+        {
+            mpeg_cleanup (mpsync);
+            free (mpsync);
+            client->format_data = NULL;
+            return -1;
+        }
+        if (mpsync == NULL)
+        {
+            mpsync = client->format_data = malloc (sizeof (mpeg_sync));
+            mpeg_setup (mpsync, plugin->mount);
+        }
+        return mpeg_complete_frames (mpsync, refbuf, 0);
+    }
     if (refbuf)
     {
         unprocessed = mpeg_complete_frames (&source_mp3->file_sync, refbuf, 0);
@@ -705,6 +799,7 @@ static int validate_mpeg (source_t *source, refbuf_t *refbuf)
 
     int unprocessed = mpeg_complete_frames (mpeg_sync, refbuf, 0);
 
+    refbuf->duration = mpeg_sync->duration;
     if (unprocessed < 0 || unprocessed > 8000) /* too much unprocessed really, may not be parsing */
     {
         if (unprocessed > 0 && refbuf->len)
@@ -718,20 +813,6 @@ static int validate_mpeg (source_t *source, refbuf_t *refbuf)
         size_t len;
         refbuf_t *leftover;
 
-        if (source_mp3->inline_metadata_interval > 0)
-        {
-            if (source_mp3->inline_metadata_interval <= source_mp3->offset)
-            {
-                // reached meta but we have a frame fragment, so keep it for later
-                leftover = refbuf_new (unprocessed);
-                memcpy (leftover->data, refbuf->data + refbuf->len, unprocessed);
-                mpeg_data_insert (mpeg_sync, leftover);
-                client->pos = 0;
-                return refbuf->len ? 0 : -1;
-            }
-            // not reached the metadata block so save and rewind for completing the read
-            source_mp3->offset -= unprocessed;
-        }
         /* make sure the new block has a minimum of queue_block_size */
         if (unprocessed < source_mp3->queue_block_size)
             len = source_mp3->queue_block_size;
@@ -781,98 +862,83 @@ static refbuf_t *mp3_get_no_meta (source_t *source)
 }
 
 
-/* read mp3 data with inlined metadata from the source. Filter out the
- * metadata so that the mp3 data itself is store on the queue and the
- * metadata is is associated with it
+/* read the inline metadata block straight into the build area, returns
+ * 1 when the block is complete, 0 if more data is needed and -1 on error
  */
-static refbuf_t *mp3_get_filter_meta (source_t *source)
+static int read_inline_metadata (source_t *source)
 {
-    refbuf_t *refbuf;
     format_plugin_t *plugin = source->format;
     mp3_state *source_mp3 = plugin->_state;
-    client_t *client = source->client;  // maybe move mp3_state into client instead of plugin?
-    unsigned char *src;
-    unsigned int bytes, mp3_block;
+    client_t *client = source->client;
+    unsigned int remaining;
+    int bytes;
 
-    if (complete_read (source) == 0)
-        return NULL;
+    /* len == 0 indicates not seen the length byte yet */
+    if (source_mp3->build_metadata_len == 0)
+    {
+        bytes = client_read_bytes (client, source_mp3->build_metadata, 1);
+        if (bytes <= 0)
+            return 0;
+        plugin->read_bytes++;
+        source_mp3->build_metadata_offset = 1;
+        source_mp3->build_metadata_len = 1 + (*(unsigned char*)source_mp3->build_metadata * 16);
+    }
+    remaining = source_mp3->build_metadata_len - source_mp3->build_metadata_offset;
+    if (remaining)
+    {
+        bytes = client_read_bytes (client, source_mp3->build_metadata + source_mp3->build_metadata_offset, remaining);
+        if (bytes <= 0)
+            return 0;
+        rate_add (plugin->in_bitrate, bytes, client->worker->current_time.tv_sec);
+        plugin->read_bytes += bytes;
+        source_mp3->build_metadata_offset += bytes;
+        if ((unsigned int)bytes < remaining)
+            return 0;
+        /* the last byte is padding, that way we know a null byte terminates the message */
+        source_mp3->build_metadata [source_mp3->build_metadata_len-1] = '\0';
+    }
+    if (source_mp3->build_metadata_len > 1 && parse_icy_metadata (source->mount, source_mp3) < 0)
+    {
+        WARN1 ("Unable to parse metadata insert for %s", source->mount);
+        source->flags &= ~SOURCE_RUNNING;
+        return -1;
+    }
+    source_mp3->offset = 0;
+    source_mp3->build_metadata_len = 0;
+    return 1;
+}
 
-    refbuf = source_mp3->read_data;
-    source_mp3->read_data = NULL;
-    src = (unsigned char *)refbuf->data;
 
-    /* fill the buffer with the read data */
-    bytes = source_mp3->read_count;
-    refbuf->len = 0;
+/* read mp3 data with inlined metadata from the source. The reads stop at
+ * each metadata block which is read separately, so the mp3 data itself is
+ * stored on the queue without being moved and the metadata is associated
+ * with it
+ */
+static refbuf_t *mp3_get_filter_meta (source_t *source)
+{
+    refbuf_t *refbuf;
+    format_plugin_t *plugin = source->format;
+    mp3_state *source_mp3 = plugin->_state;
+    client_t *client = source->client;  // maybe move mp3_state into client instead of plugin?
 
-    while (bytes > 0)
+    while (1)
     {
-        unsigned int metadata_remaining;
-
-        mp3_block = source_mp3->inline_metadata_interval - source_mp3->offset;
-
-        /* is there only enough to account for mp3 data */
-        if (bytes <= mp3_block)
+        if (source_mp3->offset >= source_mp3->inline_metadata_interval)
         {
-            refbuf->len += bytes;
-            source_mp3->offset += bytes;
-            break;
-        }
-        /* we have enough data to get to the metadata
-         * block, but only transfer upto it */
-        if (mp3_block)
-        {
-            src += mp3_block;
-            bytes -= mp3_block;
-            refbuf->len += mp3_block;
-            source_mp3->offset += mp3_block;
+            if (read_inline_metadata (source) <= 0)
+                return NULL;
             continue;
         }
-
-        /* process the inline metadata, len == 0 indicates not seen any yet */
-        if (source_mp3->build_metadata_len == 0)
-        {
-            memset (source_mp3->build_metadata, 0,
-                    sizeof (source_mp3->build_metadata));
-            source_mp3->build_metadata_offset = 0;
-            source_mp3->build_metadata_len = 1 + (*src * 16);
-        }
-
-        /* do we have all of the metatdata block */
-        metadata_remaining = source_mp3->build_metadata_len -
-            source_mp3->build_metadata_offset;
-        if (bytes < metadata_remaining)
-        {
-            memcpy (source_mp3->build_metadata +
-                    source_mp3->build_metadata_offset, src, bytes);
-            source_mp3->build_metadata_offset += bytes;
+        if (complete_read (source))
             break;
-        }
-        /* copy all bytes except the last one, that way we 
-         * know a null byte terminates the message */
-        memcpy (source_mp3->build_metadata + source_mp3->build_metadata_offset,
-                src, metadata_remaining-1);
-
-        /* overwrite metadata in the buffer */
-        bytes -= metadata_remaining;
-        memmove (src, src+metadata_remaining, bytes);
-
-        if (source_mp3->build_metadata_len > 1 && parse_icy_metadata (source->mount, source_mp3) < 0)
-        {
-            WARN1 ("Unable to parse metadata insert for %s", source->mount);
-            source->flags &= ~SOURCE_RUNNING;
-            refbuf_release (refbuf);
-            return NULL;
-        }
-        source_mp3->offset = 0;
-        source_mp3->build_metadata_len = 0;
-    }
-    /* the data we have just read may of just been metadata */
-    if (refbuf->len <= 0)
-    {
-        refbuf_release (refbuf);
-        return NULL;
+        if (source_mp3->offset < source_mp3->inline_metadata_interval)
+            return NULL;    /* wait for more data */
     }
+    refbuf = source_mp3->read_data;
+    refbuf->len = source_mp3->read_count;
+    source_mp3->read_count = 0;
+    source_mp3->read_data = NULL;
+
     if (client->format_data && validate_mpeg (source, refbuf) < 0)
     {
         refbuf_release (refbuf);
@@ -1011,12 +1077,10 @@ static void free_mp3_client_data (client_t *client)
 
 static void write_mp3_to_file (struct source_tag *source, refbuf_t *refbuf)
 {
-    if (refbuf->len == 0)
-        return;
-    if (fwrite (refbuf->data, 1, refbuf->len, source->dumpfile) < refbuf->len)
+    if (dumpfile_write (source->dumpfile, refbuf) < 0)
     {
         WARN0 ("Write to dump file failed, disabling");
-        fclose (source->dumpfile);
+        dumpfile_close (source->dumpfile);
         source->dumpfile = NULL;
     }
 }
@@ -62,6 +62,10 @@ static int write_buf_to_client (client_t *client);
 static void apply_ogg_settings (format_plugin_t *format, mount_proxy *mount);
 
 
+/* limits on header pages sent to a listener in one write */
+#define OGG_HEADER_GATHER       8
+#define OGG_HEADER_GATHER_BYTES 16384
+
 struct ogg_client
 {
     refbuf_t *headers;
@@ -71,17 +75,85 @@ struct ogg_client
 };
 
 
+/* copy the page out of the sync buffer. libogg normally leaves the body
+ * straight after the header so a single copy is usually enough
+ */
+static void copy_page (char *dest, ogg_page *page)
+{
+    if (page->body == page->header + page->header_len)
+        memcpy (dest, page->header, page->header_len + page->body_len);
+    else
+    {
+        memcpy (dest, page->header, page->header_len);
+        memcpy (dest + page->header_len, page->body, page->body_len);
+    }
+}
+
+
+/* work out the media time the page covers, if we can */
+static unsigned int page_duration (ogg_codec_t *codec, ogg_page *page)
+{
+    unsigned int duration = 0;
+
+    if (codec && codec->granule_rate > 0)
+    {
+        ogg_int64_t granulepos = ogg_page_granulepos (page);
+
+        if (granulepos > 0)
+        {
+            if (codec->last_granulepos > 0 && granulepos > codec->last_granulepos)
+                duration = (unsigned int)((granulepos - codec->last_granulepos) * 1000000 / codec->granule_rate);
+            codec->last_granulepos = granulepos;
+        }
+    }
+    return duration;
+}
+
+
+static refbuf_t *page_to_refbuf (ogg_codec_t *codec, ogg_page *page)
+{
+    refbuf_t *refbuf = refbuf_new (page->header_len + page->body_len);
+
+    copy_page (refbuf->data, page);
+    refbuf->duration = page_duration (codec, page);
+    return refbuf;
+}
+
+
+/* create a queue block for the page. If the previous page from the same
+ * codec is still waiting to go on the queue then the page is appended
+ * to that block instead, a reference to it is returned in that case.
+ */
 refbuf_t *make_refbuf_with_page (ogg_codec_t *codec, ogg_page *page)
 {
-    refbuf_t *refbuf;
+    ogg_state_t *ogg_info;
+    refbuf_t *batch;
+    unsigned int len;
 
     if (codec && codec->filtered)
         return NULL;
-    refbuf = refbuf_new (page->header_len + page->body_len);
+    ogg_info = codec ? codec->parent : NULL;
+    batch = ogg_info ? ogg_info->batch : NULL;
+    len = page->header_len + page->body_len;
 
-    memcpy (refbuf->data, page->header, page->header_len);
-    memcpy (refbuf->data+page->header_len, page->body, page->body_len);
-    return refbuf;
+    if (batch && ogg_info->batch_codec == codec && ogg_info->codec_sync == NULL &&
+            batch->associated == ogg_info->header_pages && batch->len + len <= OGG_BATCH_SIZE)
+    {
+        if (ogg_info->batch_space < batch->len + len)
+        {
+            char *data = realloc (batch->data, OGG_BATCH_SIZE);
+            if (data == NULL)
+                return page_to_refbuf (codec, page);
+            batch->data = data;
+            ogg_info->batch_space = OGG_BATCH_SIZE;
+        }
+        copy_page (batch->data + batch->len, page);
+        batch->len += len;
+        batch->duration += page_duration (codec, page);
+        refbuf_addref (batch);
+        return batch;
+    }
+    return page_to_refbuf (codec, page);
 }
 
 
@@ -96,7 +168,7 @@ void format_ogg_attach_header (ogg_codec_t *codec, ogg_page *page)
     if (codec->filtered)
         return;
 
-    refbuf = make_refbuf_with_page (codec, page);
+    refbuf = page_to_refbuf (codec, page);
 
     if (ogg_page_bos (page))
     {
@@ -193,6 +265,8 @@ static void format_ogg_free_plugin (format_plugin_t *plugin, client_t *client)
     ogg_state_t *state = plugin->_state;
 
     /* free memory associated with this plugin instance */
+    refbuf_release (state->batch);
+    refbuf_release (state->pending);
     free_ogg_codecs (state);
     free (state->artist);
     free (state->title);
@@ -364,8 +438,11 @@ static refbuf_t *complete_buffer (source_t *source, refbuf_t *refbuf)
 {
     ogg_state_t *ogg_info = source->format->_state;
 
-    refbuf->associated = ogg_info->header_pages;
-    refbuf_addref (refbuf->associated);
+    if (refbuf->associated == NULL)
+    {
+        refbuf->associated = ogg_info->header_pages;
+        refbuf_addref (refbuf->associated);
+    }
 
     if (ogg_info->log_metadata)
     {
@@ -373,14 +450,53 @@ static refbuf_t *complete_buffer (source_t *source, refbuf_t *refbuf)
         ogg_info->log_metadata = 0;
     }
     /* listeners can start anywhere unless the codecs themselves are
-     * marking starting points */
+     * marking starting points, which can happen after the block is made */
     if (ogg_info->codec_sync == NULL)
         refbuf->flags |= SOURCE_BLOCK_SYNC;
+    else
+        refbuf->flags |= SOURCE_BLOCK_NOMERGE;
     source->client->queue_pos += refbuf->len;
     return refbuf;
 }
 
 
+/* pages that are already sitting in the sync buffer are gathered into one
+ * queue block, as long as they are from the same codec and there are no
+ * codec specific sync points to keep track of. Returns a block ready for
+ * the queue or NULL if the page has been held back.
+ */
+static refbuf_t *batch_page (source_t *source, refbuf_t *refbuf, ogg_codec_t *codec)
+{
+    ogg_state_t *ogg_info = source->format->_state;
+    refbuf_t *ready = ogg_info->batch;
+
+    if (refbuf == ready)
+    {
+        /* page was appended, drop the extra reference */
+        refbuf_release (refbuf);
+        return NULL;
+    }
+    ogg_info->batch = NULL;
+    if (ogg_info->codec_sync || codec == NULL || refbuf->len >= OGG_BATCH_SIZE/2)
+    {
+        if (ready == NULL)
+            return complete_buffer (source, refbuf);
+        ogg_info->pending = refbuf;
+    }
+    else
+    {
+        ogg_info->batch = refbuf;
+        ogg_info->batch_codec = codec;
+        ogg_info->batch_space = refbuf->len;
+        refbuf->associated = ogg_info->header_pages;
+        refbuf_addref (refbuf->associated);
+    }
+    if (ready)
+        return complete_buffer (source, ready);
+    return NULL;
+}
+
+
 /* process the incoming page. this requires searching through the
  * currently known codecs that have been seen in the stream
  */
@@ -424,13 +540,23 @@ static refbuf_t *ogg_get_buffer (source_t *source)
             refbuf_t *refbuf = NULL;
             ogg_codec_t *codec = ogg_info->current;
 
+            if (ogg_info->pending)
+            {
+                refbuf = ogg_info->pending;
+                ogg_info->pending = NULL;
+                return complete_buffer (source, refbuf);
+            }
             /* if a codec has just been given a page then process it */
             if (codec && codec->process)
             {
                 refbuf = codec->process (ogg_info, codec);
                 if (refbuf)
-                    return complete_buffer (source, refbuf);
-
+                {
+                    refbuf = batch_page (source, refbuf, codec);
+                    if (refbuf)
+                        return refbuf;
+                    continue;
+                }
                 ogg_info->current = NULL;
             }
 
@@ -452,16 +578,27 @@ static refbuf_t *ogg_get_buffer (source_t *source)
                     return NULL;
                 }
                 if (refbuf)
-                    return complete_buffer (source, refbuf);
+                {
+                    refbuf = batch_page (source, refbuf, ogg_info->current);
+                    if (refbuf)
+                        return refbuf;
+                }
                 continue;
             }
-            /* need more stream data */
+            /* need more stream data, but send what has been gathered so far
+             * first so that no extra latency is added */
+            if (ogg_info->batch)
+            {
+                refbuf = ogg_info->batch;
+                ogg_info->batch = NULL;
+                return complete_buffer (source, refbuf);
+            }
             break;
         }
         /* we need more data to continue getting pages */
-        data = ogg_sync_buffer (&ogg_info->oy, 4096);
+        data = ogg_sync_buffer (&ogg_info->oy, OGG_READ_SIZE);
 
-        bytes = client_read_bytes (source->client, data, 4096);
+        bytes = client_read_bytes (source->client, data, OGG_READ_SIZE);
         if (bytes <= 0)
         {
             ogg_sync_wrote (&ogg_info->oy, 0);
@@ -504,7 +641,7 @@ static int send_ogg_headers (client_t *client, refbuf_t *headers)
 {
     struct ogg_client *client_data = client->format_data;
     refbuf_t *refbuf;
-    int written = 0, loop = 10;
+    int written = 0;
 
     if (client->flags & CLIENT_HAS_MOVED)
     {
@@ -519,35 +656,41 @@ static int send_ogg_headers (client_t *client, refbuf_t *headers)
         client_data->headers_sent = 0;
     }
     refbuf = client_data->header_page;
-    while (refbuf)
+    if (refbuf)
     {
-        char *data = refbuf->data + client_data->pos;
-        unsigned len = refbuf->len - client_data->pos;
+        /* the header pages are shared by all listeners, so just gather
+         * up what is left to send into one write */
+        struct connection_bufs bufs;
+        refbuf_t *page = refbuf;
+        unsigned pos = client_data->pos;
         int ret = -1;
 
-        if (len > 8192)
-            len = 8192;
+        connection_bufs_init (&bufs, OGG_HEADER_GATHER);
+        for (; page && bufs.total < OGG_HEADER_GATHER_BYTES; page = page->associated, pos = 0)
+            connection_bufs_append (&bufs, page->data + pos, page->len - pos);
         if (client->connection.error == 0)
-            ret = client_send_bytes (client, data, len);
+            ret = connection_bufs_send (&client->connection, &bufs, 0);
         if (ret > 0)
         {
-           written += ret;
-           client_data->pos += ret;
+            written = ret;
+            while (refbuf && ret >= (int)(refbuf->len - client_data->pos))
+            {
+                ret -= (refbuf->len - client_data->pos);
+                refbuf = refbuf->associated;
+                client_data->pos = 0;
+            }
+            client_data->pos += ret;
+            client_data->header_page = refbuf;
         }
-        if (ret < (int)len)
+        if (written < (int)bufs.total)
         {
+            connection_bufs_release (&bufs);
             client->schedule_ms += 50;
             return written ? written : -1;
         }
-        if (client_data->pos == refbuf->len)
-        {
-            refbuf = refbuf->associated;
-            client_data->header_page = refbuf;
-            client_data->pos = 0;
-        }
-        if (written > 10000 || loop == 0)
+        connection_bufs_release (&bufs);
+        if (refbuf)
             return written;
-        loop--;
     }
     client_data->headers_sent = 1;
     client_data->headers = headers;
@@ -599,10 +742,10 @@ static int write_ogg_data (struct source_tag *source, refbuf_t *refbuf)
 {
     int ret = 1;
 
-    if (fwrite (refbuf->data, 1, refbuf->len, source->dumpfile) != refbuf->len)
+    if (dumpfile_write (source->dumpfile, refbuf) < 0)
     {
         WARN0 ("Write to dump file failed, disabling");
-        fclose (source->dumpfile);
+        dumpfile_close (source->dumpfile);
         source->dumpfile = NULL;
         ret = 0;
     }
@@ -22,6 +22,10 @@
 #include "refbuf.h"
 #include "format.h"
 
+/* limit for gathering pages into a single queue block */
+#define OGG_BATCH_SIZE      16384
+#define OGG_READ_SIZE       16384
+
 typedef struct ogg_state_tag
 {
     char *mount;
@@ -45,6 +49,10 @@ typedef struct ogg_state_tag
     int filter_theora;
     struct ogg_codec_tag *current;
     struct ogg_codec_tag *codec_sync;
+    refbuf_t *batch;
+    refbuf_t *pending;
+    struct ogg_codec_tag *batch_codec;
+    unsigned int batch_space;
 } ogg_state_t;
 
 
@@ -60,6 +68,8 @@ typedef struct ogg_codec_tag
     void *specific;
     refbuf_t        *possible_start;
     refbuf_t        *page;
+    long            granule_rate;   /* granules per second if audio, for timing */
+    ogg_int64_t     last_granulepos;
 
     refbuf_t *(*process)(ogg_state_t *ogg_info, struct ogg_codec_tag *codec);
     refbuf_t *(*process_page)(ogg_state_t *ogg_info,
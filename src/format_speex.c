@@ -88,6 +88,7 @@ ogg_codec_t *initial_speex_page (format_plugin_t *plugin, ogg_page *page)
     codec->codec_free = speex_codec_free;
     codec->headers = 1;
     codec->parent = ogg_info;
+    codec->granule_rate = header->rate;
     format_ogg_attach_header (codec, page);
     free (header);
     return codec;
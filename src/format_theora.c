@@ -33,6 +33,10 @@
 #include "logging.h"
 #ifdef WITH_VIDEO_PREVIEW
 #include <png.h>
+#include <zlib.h>
+
+/* larger frames are scaled down by skipping pixels for the preview */
+#define VIDEO_PREVIEW_MAX_WIDTH     640
 
 typedef struct _video_preview_struct
 {
@@ -43,6 +47,8 @@ typedef struct _video_preview_struct
 	int         video_height                  ;
 	int         x_crop_offset                 ;
 	int         y_crop_offset                 ;
+	int         scale                         ;
+	refbuf_t   *png                           ;   /* encoded image, until next preview frame */
 } video_preview_t;
 #endif
 
@@ -77,7 +83,6 @@ struct preview_details
 };
 
 static void yuv2rgb (yuv_buffer *_yuv, video_preview_t *video_preview);
-static int clip (int x);
 
 
 static void user_write_data (png_structp png_ptr, png_bytep data, png_size_t length)
@@ -126,13 +131,14 @@ static void user_flush_data (png_structp png_ptr)
 
 static void user_error (png_structp png_ptr, png_const_charp c)
 {
-    longjmp (png_ptr->jmpbuf, 1);
+    longjmp (png_jmpbuf (png_ptr), 1);
 }
 
 
 void free_video_preview (video_preview_t *video_preview)
 {
     DEBUG0 ("freeing video preview");
+    refbuf_release (video_preview->png);
     free (video_preview->rgb_image);
     free (video_preview);
 }
@@ -148,8 +154,11 @@ video_preview_t *init_video_preview (int width, int height, int _x_crop_offset,
     video_preview -> rgb_image              = NULL;
     video_preview -> png_compression_level  = Z_BEST_SPEED;
 
-    video_preview -> video_width            = width;
-    video_preview -> video_height           = height;
+    video_preview -> scale                  = 1;
+    while (width / video_preview->scale > VIDEO_PREVIEW_MAX_WIDTH)
+        video_preview -> scale *= 2;
+    video_preview -> video_width            = width / video_preview->scale;
+    video_preview -> video_height           = height / video_preview->scale;
     video_preview -> x_crop_offset          = _x_crop_offset;
     video_preview -> y_crop_offset          = _y_crop_offset;
 
@@ -165,31 +174,42 @@ video_preview_t *init_video_preview (int width, int height, int _x_crop_offset,
 }
 
 
-static int write_video_preview (client_t *client, video_preview_t *video_preview)
+/* encode the current preview frame, the result is kept until the next
+ * frame is converted so repeated requests just get another reference
+ */
+static refbuf_t *encode_video_preview (video_preview_t *video_preview)
 {
     int i;
     png_structp png_ptr = NULL;
     png_infop info_ptr = NULL;
     struct preview_details preview;
+    refbuf_t *chain = NULL, *png;
 
     preview.total_length = 0;
-    preview.last = &client->refbuf->next;
+    preview.last = &chain;
 
     png_ptr = png_create_write_struct (PNG_LIBPNG_VER_STRING, (png_voidp)NULL, NULL, NULL);
     if (png_ptr == NULL)
-        return -1;
+        return NULL;
 
     info_ptr = png_create_info_struct (png_ptr);
     if (info_ptr == NULL)
     {
         png_destroy_write_struct (&png_ptr, (png_infopp)NULL);
-        return -1;
+        return NULL;
     }
 
-    if (setjmp (png_ptr->jmpbuf))
+    if (setjmp (png_jmpbuf (png_ptr)))
     {
         png_destroy_write_struct (&png_ptr, (png_infopp)NULL);
-        return -1;
+        while (chain)
+        {
+            refbuf_t *next = chain->next;
+            chain->next = NULL;
+            refbuf_release (chain);
+            chain = next;
+        }
+        return NULL;
     }
 
     png_set_error_fn (png_ptr, NULL, user_error, user_error);
@@ -205,9 +225,8 @@ static int write_video_preview (client_t *client, video_preview_t *video_preview
             PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
     png_write_info (png_ptr, info_ptr);
-    ERROR0("finished writing png header");
+    DEBUG0("finished writing png header");
 
-    /* write image to hard disk */
     for ( i = 0; i < video_preview -> video_height; i++)
         png_write_row (png_ptr, 
                 video_preview->rgb_image + i * (video_preview->video_width) * 4 );
@@ -215,8 +234,40 @@ static int write_video_preview (client_t *client, video_preview_t *video_preview
     png_write_end (png_ptr, info_ptr);
     png_destroy_write_struct (&png_ptr, &info_ptr);
 
+    /* keep the image in a single block so it can be shared */
+    png = chain;
+    if (chain && chain->next)
+    {
+        unsigned int len = 0;
+
+        png = refbuf_new (preview.total_length);
+        while (chain)
+        {
+            refbuf_t *next = chain->next;
+            memcpy (png->data + len, chain->data, chain->len);
+            len += chain->len;
+            chain->next = NULL;
+            refbuf_release (chain);
+            chain = next;
+        }
+    }
+    return png;
+}
+
+
+static int write_video_preview (client_t *client, video_preview_t *video_preview)
+{
+    if (video_preview->png == NULL)
+    {
+        video_preview->png = encode_video_preview (video_preview);
+        if (video_preview->png == NULL)
+            return -1;
+    }
+    refbuf_addref (video_preview->png);
+    client->refbuf->next = video_preview->png;
+
     snprintf (client->refbuf->data, PER_CLIENT_REFBUF_SIZE, "HTTP/1.0 200 OK\r\n"
-            "Content-Length: %d\r\nContentType: image/png\r\n\r\n", preview.total_length);
+            "Content-Length: %u\r\nContent-Type: image/png\r\n\r\n", video_preview->png->len);
     client->refbuf->len = strlen (client->refbuf->data);
     client->respcode = 200;
 
@@ -231,74 +282,51 @@ static int get_image (client_t *client, struct ogg_codec_tag *codec)
 }
 
 
-/* ok it has to be optimized but for now it's clean, and it's ok ;) */
-static void yuv2rgb (yuv_buffer *_yuv, video_preview_t *video_preview) 
+static inline unsigned char clip (int x)
 {
-	int                     i,j;
-	int                     crop_offset;
-
-	int			y_offset;
-	int			ypp_offset;
-	int			uv_offset;
-
-	/* rgba surface pointer */
-	unsigned char          *prgb;
-	yuv_buffer             *yuv;
-
-	unsigned char    	y;
-	unsigned char		ypp;
-	unsigned char		u;
-	unsigned char		v;
-
-	yuv = _yuv;
-	
-	crop_offset = (video_preview -> x_crop_offset) + 
-		(yuv -> y_stride) * (video_preview -> y_crop_offset);
-	prgb = (unsigned char *)video_preview -> rgb_image;
-
-	for (i = 0; i < video_preview -> video_height; i++ ) {
-		for ( j = 0; j < video_preview -> video_width / 2; j++ ) {
-
-			y_offset	= yuv -> y_stride  *  i    + j*2 + crop_offset;
-			ypp_offset	= yuv -> y_stride  *  i    + j*2 + crop_offset + 1;
-			uv_offset	= yuv -> uv_stride * (i/2) + j   + crop_offset;
+	if (x > 255)
+		return 255;
+	else if (x < 0)
+		return 0;
+	return x;
+}
 
-			y		= *(yuv->y + y_offset);
-			ypp		= *(yuv->y + ypp_offset);
-			u		= *(yuv->u + uv_offset);
-			v		= *(yuv->v + uv_offset);
 
-			/* R G B A */
-			*prgb				=  clip (y + 1.402f * (v-128)) ;
-			prgb++;
-			*prgb				=  clip (y - 0.34414f * (u-128) - 0.71414f * (v-128)) ;
-			prgb++;
-			*prgb				=  clip (y + 1.772 * (u-128)) ;
-			prgb++;
-			*prgb				= 255;
-			prgb++;
+/* convert the frame to RGBA using fixed point (8 bit fraction) maths, any
+ * scale down just samples every scale pixels in each direction.
+ */
+static void yuv2rgb (yuv_buffer *yuv, video_preview_t *video_preview) 
+{
+	int i, j, step = video_preview->scale;
+	unsigned char *prgb = (unsigned char *)video_preview->rgb_image;
+
+	/* a new frame, so any encoded image is now stale */
+	refbuf_release (video_preview->png);
+	video_preview->png = NULL;
+
+	for (i = 0; i < video_preview->video_height; i++)
+	{
+		int row = i * step + video_preview->y_crop_offset;
+		const unsigned char *py = yuv->y + yuv->y_stride * row + video_preview->x_crop_offset;
+		const unsigned char *pu = yuv->u + yuv->uv_stride * (row/2);
+		const unsigned char *pv = yuv->v + yuv->uv_stride * (row/2);
+
+		for (j = 0; j < video_preview->video_width; j++)
+		{
+			int x = j * step;
+			int y = py [x];
+			int d = pu [(x + video_preview->x_crop_offset)/2] - 128;
+			int e = pv [(x + video_preview->x_crop_offset)/2] - 128;
 
 			/* R G B A */
-			*prgb				=  clip (ypp + 1.402f * (v-128)) ;
-			prgb++;
-			*prgb				=  clip (ypp - 0.34414f * (u-128) - 0.71414f * (v-128)) ;
-			prgb++;
-			*prgb				=  clip (ypp + 1.772 * (u-128)) ;
-			prgb++;
-			*prgb				= 255;
-			prgb++;
+			prgb[0] = clip (y + ((359 * e) >> 8));
+			prgb[1] = clip (y - ((88 * d + 183 * e) >> 8));
+			prgb[2] = clip (y + ((454 * d) >> 8));
+			prgb[3] = 255;
+			prgb += 4;
 		}
 	}
 }
-
-static int clip (int x)
-{
-	if (x > 255)
-		return 255;
-	else if (x < 0)
-		return 0;
-	return x;
-}
 #endif
 
 
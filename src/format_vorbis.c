@@ -548,6 +548,7 @@ static refbuf_t *process_vorbis_page (ogg_state_t *ogg_info,
         codec->headers++;
     }
     DEBUG0 ("we have the header packets now");
+    codec->granule_rate = source_vorbis->vi.rate;
 
     /* if vorbis is the only codec then allow rebuilding of the streams */
     if (ogg_info->codecs->next == NULL && ogg_info->passthrough == 0)
@@ -79,6 +79,16 @@ typedef struct {
     char *type;
 } mime_type;
 
+/* blocks read from a fallback file, kept for other listeners */
+#define FH_CACHED_BLOCKS    64
+
+struct fh_block
+{
+    refbuf_t *refbuf;
+    long offset;        /* file offset the block was read from */
+    long next;          /* file offset to read the following block from */
+};
+
 typedef struct {
     fbinfo finfo;
     mutex_t lock;
@@ -89,6 +99,8 @@ typedef struct {
     time_t stats_update;
     format_plugin_t *format;
     avl_tree *clients;
+    struct fh_block *blocks;
+    int block_next;
 } fh_node;
 
 int fserve_running;
@@ -207,6 +219,13 @@ static int _delete_fh (void *mapping)
 
     if (fh->fp)
         fclose (fh->fp);
+    if (fh->blocks)
+    {
+        int i;
+        for (i = 0; i < FH_CACHED_BLOCKS; i++)
+            refbuf_release (fh->blocks[i].refbuf);
+        free (fh->blocks);
+    }
     if (fh->format)
     {
         free (fh->format->mount);
@@ -358,6 +377,7 @@ static fh_node *open_fh (fbinfo *finfo, client_t *client)
                 free (fh);
                 return NULL;
             }
+            fh->blocks = calloc (FH_CACHED_BLOCKS, sizeof (struct fh_block));
             if (fh->format->create_client_data && client->format_data == NULL)
                 fh->format->create_client_data (fh->format, client);
             if (fh->format->write_buf_to_client)
@@ -724,6 +744,11 @@ static int fserve_move_listener (client_t *client)
     fbinfo f;
 
     _free_fserve_buffers (client);
+    if (client->flags & CLIENT_KERNEL_PACED)
+    {
+        sock_set_pacing_rate (client->connection.sock, ~0U);  /* back to unlimited */
+        client->flags &= ~CLIENT_KERNEL_PACED;
+    }
     thread_mutex_lock (&fh->lock);
     f.flags = fh->finfo.flags|FS_OVERRIDE;
     f.limit = fh->finfo.limit;
@@ -745,6 +770,7 @@ static int fserve_move_listener (client_t *client)
 }
 
 struct _client_functions throttled_file_content_ops;
+static void fserve_set_pacing (client_t *client, unsigned int limit);
 
 static int prefile_send (client_t *client)
 {
@@ -771,7 +797,10 @@ static int prefile_send (client_t *client)
                     {
                         int len = 8192;
                         if (fh->finfo.flags & FS_FALLBACK)
+                        {
                             client->ops = &throttled_file_content_ops;
+                            fserve_set_pacing (client, fh->finfo.limit);
+                        }
                         else
                             client->ops = &file_content_ops;
                         refbuf_release (client->refbuf);
@@ -879,6 +908,131 @@ static int file_send (client_t *client)
 }
 
 
+/* try to get the kernel to pace the sending for this client, if that works
+ * then larger blocks can be passed over with fewer wakeups.
+ */
+static void fserve_set_pacing (client_t *client, unsigned int limit)
+{
+    if (global.kernel_pacing == 0 || limit == 0)
+        return;
+    if (client->flags & CLIENT_WANTS_FLV)
+        limit = (unsigned long)(limit * 1.01);
+    if (sock_set_pacing_rate (client->connection.sock, limit) < 0)
+    {
+        WARN0 ("kernel pacing not available, using internal throttling");
+        global.kernel_pacing = 0;
+        return;
+    }
+    client->flags |= CLIENT_KERNEL_PACED;
+    DEBUG2 ("kernel pacing client %lu at %u bytes/s", client->connection.id, limit);
+}
+
+
+/* read the next block of a fallback file for the client. Listeners on a
+ * fallback are sent at the same rate so they tend to be at the same points
+ * in the file, recent blocks are kept so that each one is only read and
+ * parsed once. FLV framing rewrites the block it sends, so those clients
+ * always read into their own block. Called with the fh lock held.
+ */
+static int fh_file_read (client_t *client, fh_node *fh)
+{
+    refbuf_t *refbuf = client->refbuf;
+    long offset = client->intro_offset;
+    int i, ret;
+
+    if (fh->blocks == NULL || refbuf == NULL || client->pos < refbuf->len ||
+            (client->flags & (CLIENT_HAS_INTRO_CONTENT|CLIENT_WANTS_FLV)))
+        return format_file_read (client, fh->format, fh->fp);
+
+    for (i = 0; i < FH_CACHED_BLOCKS; i++)
+    {
+        struct fh_block *block = &fh->blocks[i];
+
+        if (block->refbuf && block->offset == offset)
+        {
+            client_set_queue (client, block->refbuf);
+            client->intro_offset = block->next;
+            return 0;
+        }
+    }
+    /* the current block may be shared so read into a new one */
+    refbuf = refbuf_new (4096);
+    refbuf_release (client->refbuf);
+    client->refbuf = refbuf;
+    client->pos = refbuf->len;
+    ret = format_file_read (client, fh->format, fh->fp);
+    if (ret == 0 && client->refbuf == refbuf)
+    {
+        struct fh_block *block = &fh->blocks [fh->block_next];
+
+        refbuf_release (block->refbuf);
+        refbuf_addref (refbuf);
+        block->refbuf = refbuf;
+        block->offset = offset;
+        block->next = client->intro_offset;
+        fh->block_next = (fh->block_next + 1) % FH_CACHED_BLOCKS;
+    }
+    return ret;
+}
+
+
+/* throttled send where the kernel does the pacing, we only need to keep the
+ * socket supplied so pass over about half a second of data each time.
+ */
+static int paced_file_send (client_t *client, fh_node *fh, unsigned int limit)
+{
+    worker_t *worker = client->worker;
+    unsigned long secs = worker->current_time.tv_sec - client->timer_start;
+    unsigned int written = 0, chunk = limit/2;
+    int ret = 0;
+
+    client->schedule_ms = worker->time_ms + 500;
+    /* do not let the kernel buffer get too far ahead of the rate */
+    if (secs > 2 && client->counter/secs > limit + limit/10)
+        return 0;
+
+    thread_mutex_lock (&fh->lock);
+    if (fh->stats_update <= worker->current_time.tv_sec)
+    {
+        stats_event_args (fh->finfo.mount, "outgoing_kbitrate", "%ld",
+                (long)((8 * rate_avg (fh->format->out_bitrate))/1024));
+        fh->stats_update = worker->current_time.tv_sec + 5;
+    }
+    while (written < chunk)
+    {
+        int bytes;
+
+        if (client->pos == client->refbuf->len)
+        {
+            ret = fh_file_read (client, fh);
+            if (ret == -1) /* loop fallback file */
+            {
+                client->intro_offset = 0;
+                ret = 0;
+                break;
+            }
+            if (ret == -2)
+                break;
+            ret = 0;
+            client->pos = 0;
+        }
+        bytes = client->check_buffer (client);
+        if (bytes <= 0)
+        {
+            client->schedule_ms = worker->time_ms + 100;  /* socket full */
+            break;
+        }
+        written += bytes;
+    }
+    rate_add (fh->format->out_bitrate, written, worker->time_ms);
+    thread_mutex_unlock (&fh->lock);
+    global_add_bitrates (global.out_bitrate, written, worker->time_ms);
+    if (throttle_sends > 1)
+        client->schedule_ms += 300;
+    return ret == -2 ? -1 : 0;
+}
+
+
 /* send routine for files sent at a target bitrate, eg fallback files. */
 static int throttled_file_send (client_t *client)
 {
@@ -903,6 +1057,8 @@ static int throttled_file_send (client_t *client)
 
     if (client->flags & CLIENT_WANTS_FLV) /* increase limit for flv clients as wrapping takes more space */
         limit = (unsigned long)(limit * 1.01);
+    if (client->flags & CLIENT_KERNEL_PACED)
+        return paced_file_send (client, fh, limit);
     if (secs)
         rate = (client->counter+1400)/secs;
     // DEBUG3 ("counter %lld, duration %ld, limit %u", client->counter, secs, rate);
@@ -930,7 +1086,7 @@ static int throttled_file_send (client_t *client)
     if (client->pos == refbuf->len)
     {
         //DEBUG1 ("reading another block from offset %ld", client->intro_offset);
-        int ret = format_file_read (client, fh->format, fh->fp);
+        int ret = fh_file_read (client, fh);
 
         switch (ret)
         {
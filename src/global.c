@@ -15,6 +15,7 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <string.h>
 
 #include "thread/thread.h"
@@ -26,6 +27,7 @@
 #include "client.h"
 #include "source.h"
 #include "format.h"
+#include "md5.h"
 
 #include "global.h"
 
@@ -33,6 +35,29 @@ ice_global_t global;
 
 static mutex_t _global_mutex;
 
+/* fill in the secret used for resume tokens, fall back to hashing the time
+ * if there is no random device available
+ */
+static void global_resume_secret (void)
+{
+    FILE *f = fopen ("/dev/urandom", "rb");
+    size_t len = sizeof (global.resume_secret);
+
+    if (f == NULL || fread (global.resume_secret, 1, len, f) != len)
+    {
+        struct MD5Context context;
+        uint64_t now = timing_get_time();
+        void *p = &now;
+
+        MD5Init (&context);
+        MD5Update (&context, (unsigned char *)&now, sizeof (now));
+        MD5Update (&context, (unsigned char *)&p, sizeof (p));
+        MD5Final (global.resume_secret, &context);
+    }
+    if (f)
+        fclose (f);
+}
+
 void global_initialize(void)
 {
     global.server_sockets = 0;
@@ -48,6 +73,7 @@ void global_initialize(void)
     thread_mutex_create(&_global_mutex);
     thread_spin_create (&global.spinlock);
     global.out_bitrate = rate_setup (20000, 1000);
+    global_resume_secret();
 }
 
 void global_shutdown(void)
@@ -110,6 +136,31 @@ unsigned long global_getrate_avg (struct rate_calc *rate)
     return v;
 }
 
+/* account for a change in the amount of data held on the source queues and
+ * work out how much pressure the server is under from the configured budget.
+ * 1 shrinks bursts, 2 trims idle mounts and 3 trims queues on all mounts.
+ */
+void global_queue_memory (long change)
+{
+    thread_spin_lock (&global.spinlock);
+    global.queue_memory += change;
+    if (global.queue_memory_limit > 0)
+    {
+        int64_t percent = global.queue_memory * 100 / global.queue_memory_limit;
+        if (percent >= 95)
+            global.queue_pressure = 3;
+        else if (percent >= 85)
+            global.queue_pressure = 2;
+        else if (percent >= 70)
+            global.queue_pressure = 1;
+        else
+            global.queue_pressure = 0;
+    }
+    else
+        global.queue_pressure = 0;
+    thread_spin_unlock (&global.spinlock);
+}
+
 #ifdef MY_ALLOC
 
 #undef malloc
@@ -59,6 +59,16 @@ typedef struct ice_global_tag
     spin_t spinlock;
     struct rate_calc *out_bitrate;
 
+    /* bytes held in all source queues and the server-wide budget for them */
+    int64_t queue_memory;
+    int64_t queue_memory_limit;
+    int queue_pressure;
+
+    int kernel_pacing;  /* use socket pacing for rate limited sends */
+
+    /* per-run random value mixed into listener resume tokens */
+    unsigned char resume_secret [16];
+
     cond_t shutdown_cond;
 } ice_global_t;
 
@@ -100,5 +110,6 @@ void global_unlock(void);
 void global_add_bitrates (struct rate_calc *rate, unsigned long value, uint64_t milli);
 void global_reduce_bitrate_sampling (struct rate_calc *rate);
 unsigned long global_getrate_avg (struct rate_calc *rate);
+void global_queue_memory (long change);
 
 #endif  /* __GLOBAL_H__ */
@@ -35,6 +35,11 @@
 #define LOG_MAXLOGS logs_allocated
 #define LOG_MAXLINELEN 1024
 
+/* limit on lines waiting to be written for a log in async mode */
+#define LOG_QUEUE_LIMIT     (512*1024)
+/* how often (ms) the async writer checks for lines to write */
+#define LOG_WRITER_INTERVAL 100
+
 #ifdef _WIN32
 #define mutex_t CRITICAL_SECTION
 // #define snprintf _snprintf
@@ -46,6 +51,17 @@
 static mutex_t _logger_mutex;
 static int _initialized = 0;
 
+#ifndef _WIN32
+/* lines for logs in async mode are queued under this lock, so that callers
+ * do not wait on the logger lock or the file writes */
+static mutex_t _queue_mutex;
+static pthread_t _writer_thread;
+static int _writer_running;
+static time_t _date_time;
+static char _date [40];
+static int _date_len;
+#endif
+
 typedef struct _log_entry_t
 {
    struct _log_entry_t *next;
@@ -75,6 +91,13 @@ typedef struct log_tag
     log_entry_t *log_tail;
     
     char *buffer;
+
+    /* async mode, lines waiting for the writer thread */
+    int async;
+    char *queue;
+    unsigned int queue_len;
+    unsigned int queue_size;
+    unsigned long dropped;
 } log_t;
 
 int logs_allocated;
@@ -84,6 +107,9 @@ static int _get_log_id(void);
 static void _release_log_id(int log_id);
 static void _lock_logger(void);
 static void _unlock_logger(void);
+#ifndef _WIN32
+static void _log_drain (int log_id);
+#endif
 
 
 static int _log_open (int id, time_t now)
@@ -125,7 +151,8 @@ static int _log_open (int id, time_t now)
             loglist [id] . logfile = fopen (loglist [id] . filename, "a");
             if (loglist [id] . logfile == NULL)
                 return 0;
-            setvbuf (loglist [id] . logfile, NULL, IO_BUFFER_TYPE, 0);
+            /* the async writer flushes after each batch of lines */
+            setvbuf (loglist [id] . logfile, NULL, loglist [id] . async ? _IOFBF : IO_BUFFER_TYPE, 0);
             if (stat (loglist [id] . filename, &st) < 0)
                 loglist [id] . size = 0;
             else
@@ -154,6 +181,11 @@ static void log_init (log_t *log)
     log->keep_entries = 0;
     log->log_head = NULL;
     log->log_tail = NULL;
+    log->async = 0;
+    log->queue = NULL;
+    log->queue_len = 0;
+    log->queue_size = 0;
+    log->dropped = 0;
 }
 
 void log_initialize(void)
@@ -165,6 +197,7 @@ void log_initialize(void)
     /* initialize mutexes */
 #ifndef _WIN32
     pthread_mutex_init(&_logger_mutex, NULL);
+    pthread_mutex_init(&_queue_mutex, NULL);
 #else
     InitializeCriticalSection(&_logger_mutex);
 #endif
@@ -308,6 +341,9 @@ void log_flush(int log_id)
     if (log_id < 0 || log_id >= LOG_MAXLOGS) return;
     if (loglist[log_id].in_use == 0) return;
 
+#ifndef _WIN32
+    _log_drain (log_id);
+#endif
     _lock_logger();
     if (loglist[log_id].logfile)
         fflush(loglist[log_id].logfile);
@@ -331,6 +367,9 @@ void log_close(int log_id)
 {
     if (log_id < 0 || log_id >= LOG_MAXLOGS) return;
 
+#ifndef _WIN32
+    _log_drain (log_id);
+#endif
     _lock_logger();
 
     if (loglist[log_id].in_use == 0)
@@ -360,15 +399,32 @@ void log_close(int log_id)
         loglist [log_id].entries--;
     }
     loglist [log_id].entries = 0;
+#ifndef _WIN32
+    pthread_mutex_lock (&_queue_mutex);
+    loglist [log_id].async = 0;
+    free (loglist [log_id].queue);
+    loglist [log_id].queue = NULL;
+    loglist [log_id].queue_len = loglist [log_id].queue_size = 0;
+    loglist [log_id].dropped = 0;
+    pthread_mutex_unlock (&_queue_mutex);
+#endif
     _unlock_logger();
 }
 
 void log_shutdown(void)
 {
+#ifndef _WIN32
+    if (_writer_running)
+    {
+        _writer_running = 0;
+        pthread_join (_writer_thread, NULL);
+    }
+#endif
     free (loglist);
     /* destroy mutexes */
 #ifndef _WIN32
     pthread_mutex_destroy(&_logger_mutex);
+    pthread_mutex_destroy(&_queue_mutex);
 #else
     DeleteCriticalSection(&_logger_mutex);
 #endif 
@@ -442,6 +498,166 @@ void log_contents (int log_id, char **_contents, unsigned int *_len)
 }
 
 
+#ifndef _WIN32
+/* add a line to the queue of an async log, the date prefix is only rebuilt
+ * when the second changes and is not added if prior is NULL. Lines are
+ * dropped when the queue is full.
+ */
+static void _log_queue (int log_id, time_t now, const char *prior, const char *cat,
+        const char *func, const char *line)
+{
+    log_t *log;
+    int len;
+
+    pthread_mutex_lock (&_queue_mutex);
+    log = &loglist [log_id];
+    if (prior && now != _date_time)
+    {
+        _date_len = strftime (_date, sizeof (_date), "[%Y-%m-%d  %H:%M:%S]", localtime (&now));
+        _date_time = now;
+    }
+    do
+    {
+        unsigned int needed = strlen (line) + 1;
+
+        if (prior)
+            needed += _date_len + strlen (prior) + strlen (cat) + strlen (func) + 3;
+
+        if (log->queue_len + needed > log->queue_size)
+        {
+            unsigned int size = log->queue_size ? log->queue_size * 2 : 16384;
+            char *queue;
+
+            while (size < log->queue_len + needed)
+                size *= 2;
+            if (size > LOG_QUEUE_LIMIT || (queue = realloc (log->queue, size)) == NULL)
+            {
+                log->dropped++;
+                break;
+            }
+            log->queue = queue;
+            log->queue_size = size;
+        }
+        if (prior)
+            len = snprintf (log->queue + log->queue_len, log->queue_size - log->queue_len,
+                    "%s %s %s%s %s", _date, prior, cat, func, line);
+        else
+            len = snprintf (log->queue + log->queue_len, log->queue_size - log->queue_len,
+                    "%s", line);
+        log->queue_len += len + 1;
+    } while (0);
+    pthread_mutex_unlock (&_queue_mutex);
+}
+
+
+/* write out the lines queued for an async log */
+static void _log_drain (int log_id)
+{
+    char *queue, *line;
+    unsigned int len;
+    unsigned long dropped;
+    time_t now = time (NULL);
+
+    pthread_mutex_lock (&_queue_mutex);
+    if (log_id >= logs_allocated || (loglist [log_id].queue == NULL && loglist [log_id].dropped == 0))
+    {
+        pthread_mutex_unlock (&_queue_mutex);
+        return;
+    }
+    queue = loglist [log_id].queue;
+    len = loglist [log_id].queue_len;
+    dropped = loglist [log_id].dropped;
+    loglist [log_id].queue = NULL;
+    loglist [log_id].queue_len = loglist [log_id].queue_size = 0;
+    loglist [log_id].dropped = 0;
+    pthread_mutex_unlock (&_queue_mutex);
+
+    _lock_logger();
+    if (_log_open (log_id, now))
+    {
+        int ret;
+
+        for (line = queue; line && line < queue + len; line += strlen (line) + 1)
+        {
+            ret = create_log_entry (log_id, "", line);
+            if (ret > 0)
+                loglist [log_id].size += ret;
+        }
+        if (dropped)
+        {
+            char msg [150];
+            int datelen = strftime (msg, sizeof (msg), "[%Y-%m-%d  %H:%M:%S]", localtime (&now));
+            snprintf (msg + datelen, sizeof (msg) - datelen,
+                    " WARN log/async %lu lines dropped, queue was full", dropped);
+            ret = create_log_entry (log_id, "", msg);
+            if (ret > 0)
+                loglist [log_id].size += ret;
+        }
+        fflush (loglist [log_id].logfile);
+    }
+    _unlock_logger();
+    free (queue);
+}
+
+
+static void *_log_writer (void *arg)
+{
+    while (_writer_running)
+    {
+        struct timespec ts = { 0, LOG_WRITER_INTERVAL * 1000000 };
+        int i;
+
+        nanosleep (&ts, NULL);
+        for (i = 0; i < logs_allocated; i++)
+            _log_drain (i);
+    }
+    return NULL;
+}
+#endif
+
+
+/* In async mode lines are queued and written out on a separate thread
+ * rather than by the caller.
+ */
+int log_set_async (int log_id, int async)
+{
+#ifndef _WIN32
+    if (log_id < 0 || log_id >= LOG_MAXLOGS) return LOG_EINSANE;
+    if (loglist[log_id].in_use == 0) return LOG_ENOTOPEN;
+
+    async = async ? 1 : 0;
+    if (loglist[log_id].async == async)
+        return 0;
+    _lock_logger();
+    if (async && _writer_running == 0)
+    {
+        _writer_running = 1;
+        if (pthread_create (&_writer_thread, NULL, _log_writer, NULL))
+        {
+            _writer_running = 0;
+            _unlock_logger();
+            return LOG_EINSANE;
+        }
+    }
+    /* reopen to change the file buffering */
+    if (loglist [log_id] . filename && loglist [log_id] . logfile)
+    {
+        fclose (loglist [log_id] . logfile);
+        loglist [log_id] . logfile = NULL;
+    }
+    pthread_mutex_lock (&_queue_mutex);
+    loglist [log_id].async = async;
+    pthread_mutex_unlock (&_queue_mutex);
+    _unlock_logger();
+    if (async == 0)
+        _log_drain (log_id);
+    return 0;
+#else
+    return LOG_ENOTIMPL;
+#endif
+}
+
+
 void log_write(int log_id, unsigned priority, const char *cat, const char *func, 
         const char *fmt, ...)
 {
@@ -458,9 +674,17 @@ void log_write(int log_id, unsigned priority, const char *cat, const char *func,
 
     va_start(ap, fmt);
     vsnprintf(line, LOG_MAXLINELEN, fmt, ap);
+    va_end(ap);
 
     now = time(NULL);
 
+#ifndef _WIN32
+    if (loglist[log_id].async)
+    {
+        _log_queue (log_id, now, prior [priority-1], cat, func, line);
+        return;
+    }
+#endif
     _lock_logger();
     datelen = strftime (pre, sizeof (pre), "[%Y-%m-%d  %H:%M:%S]", localtime(&now)); 
 
@@ -473,8 +697,6 @@ void log_write(int log_id, unsigned priority, const char *cat, const char *func,
             loglist[log_id].size += len;
     }
     _unlock_logger();
-
-    va_end(ap);
 }
 
 void log_write_direct(int log_id, const char *fmt, ...)
@@ -489,6 +711,15 @@ void log_write_direct(int log_id, const char *fmt, ...)
 
     now = time(NULL);
 
+#ifndef _WIN32
+    if (loglist[log_id].async)
+    {
+        vsnprintf(line, LOG_MAXLINELEN, fmt, ap);
+        va_end(ap);
+        _log_queue (log_id, now, NULL, NULL, NULL, line);
+        return;
+    }
+#endif
     _lock_logger();
     vsnprintf(line, LOG_MAXLINELEN, fmt, ap);
     if (_log_open (log_id, now))
@@ -521,7 +752,12 @@ static int _get_log_id(void)
     if (id == -1)
     {
         int new_count = logs_allocated + 20;
-        log_t *new_list = realloc (loglist, new_count * sizeof (log_t));
+        log_t *new_list;
+
+#ifndef _WIN32
+        pthread_mutex_lock (&_queue_mutex);
+#endif
+        new_list = realloc (loglist, new_count * sizeof (log_t));
         if (new_list)
         {
             for (i = logs_allocated; i < new_count; i++)
@@ -531,6 +767,9 @@ static int _get_log_id(void)
             loglist[id].in_use = 1;
             logs_allocated = new_count;
         }
+#ifndef _WIN32
+        pthread_mutex_unlock (&_queue_mutex);
+#endif
     }
 
     /* unlock mutex */
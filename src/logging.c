@@ -37,6 +37,11 @@ void fatal_error (const char *perr);
 int errorlog = 0;
 int playlistlog = 0;
 
+/* date last used in the access and playlist logs */
+static mutex_t clf_date_lock;
+static time_t clf_date_time;
+static char clf_date [50];
+
 #ifdef _MSC_VER
 /* Since strftime's %z option on win32 is different, we need
    to go through a few loops to get the same info as %z */
@@ -91,6 +96,55 @@ int get_clf_time (char *buffer, unsigned len, struct tm *t)
     return 1;
 }
 #endif
+
+
+/* many lines are logged within the same second, so the date is only built
+ * when the second changes.
+ */
+static void logging_clf_date (char *buf, unsigned int len, time_t now)
+{
+    thread_mutex_lock (&clf_date_lock);
+    if (now != clf_date_time)
+    {
+        struct tm thetime;
+
+        localtime_r (&now, &thetime);
+#ifdef _MSC_VER
+        memset (clf_date, '\000', sizeof (clf_date));
+        get_clf_time (clf_date, sizeof (clf_date)-1, &thetime);
+#else
+        strftime (clf_date, sizeof (clf_date), LOGGING_FORMAT_CLF, &thetime);
+#endif
+        clf_date_time = now;
+    }
+    snprintf (buf, len, "%s", clf_date);
+    thread_mutex_unlock (&clf_date_lock);
+}
+
+
+/* copy src into a JSON string, truncating to fit */
+static void logging_json_escape (char *dst, unsigned int len, const char *src)
+{
+    unsigned int i = 0;
+
+    for (; src && *src && i + 7 < len; src++)
+    {
+        unsigned char c = *src;
+
+        if (c == '"' || c == '\\')
+        {
+            dst [i++] = '\\';
+            dst [i++] = c;
+        }
+        else if (c < 0x20)
+            i += snprintf (dst + i, len - i, "\\u%04x", c);
+        else
+            dst [i++] = c;
+    }
+    dst [i] = '\0';
+}
+
+
 /* 
 ** ADDR IDENT USER DATE REQUEST CODE BYTES REFERER AGENT [TIME]
 **
@@ -108,7 +162,6 @@ int get_clf_time (char *buffer, unsigned len, struct tm *t)
 void logging_access_id (access_log *accesslog, client_t *client)
 {
     const char *req = NULL;
-    struct tm thetime;
     time_t now;
     time_t stayed;
     const char *referrer, *user_agent, *username, *ip = "-";
@@ -120,14 +173,6 @@ void logging_access_id (access_log *accesslog, client_t *client)
 
     now = time(NULL);
 
-    localtime_r (&now, &thetime);
-    /* build the data */
-#ifdef _MSC_VER
-    memset(datebuf, '\000', sizeof(datebuf));
-    get_clf_time(datebuf, sizeof(datebuf)-1, &thetime);
-#else
-    strftime (datebuf, sizeof(datebuf), LOGGING_FORMAT_CLF, &thetime);
-#endif
     if (accesslog->qstr)
         req = httpp_getvar (client->parser, HTTPP_VAR_RAWURI);
     if (req == NULL)
@@ -146,6 +191,23 @@ void logging_access_id (access_log *accesslog, client_t *client)
     if (accesslog->log_ip)
         ip = client->connection.ip;
 
+    if (accesslog->type == LOG_ACCESS_JSON)
+    {
+        char un [100], rq [300], rf [200], ua [200];
+
+        logging_json_escape (un, sizeof un, username);
+        logging_json_escape (rq, sizeof rq, reqbuf);
+        logging_json_escape (rf, sizeof rf, referrer);
+        logging_json_escape (ua, sizeof ua, user_agent);
+        log_write_direct (accesslog->logid,
+                "{\"ip\":\"%s\",\"user\":\"%s\",\"time\":%ld,\"request\":\"%s\",\"status\":%d,"
+                "\"bytes\":%" PRIu64 ",\"referer\":\"%s\",\"agent\":\"%s\",\"duration\":%lu}",
+                ip, un, (long)now, rq, client->respcode, client->connection.sent_bytes,
+                rf, ua, (unsigned long)stayed);
+        client->respcode = -1;
+        return;
+    }
+    logging_clf_date (datebuf, sizeof datebuf, now);
     if (accesslog->type == LOG_ACCESS_CLF_ESC)
     {
         char *un = client->username ? util_url_escape (username) : strdup ("-"),
@@ -191,23 +253,12 @@ void logging_access (client_t *client)
 void logging_playlist(const char *mount, const char *metadata, long listeners)
 {
     char datebuf[128];
-    struct tm thetime;
-    time_t now;
 
     if (playlistlog == -1) {
         return;
     }
 
-    now = time(NULL);
-
-    localtime_r (&now, &thetime);
-    /* build the data */
-#ifdef _MSC_VER
-    memset(datebuf, '\000', sizeof(datebuf));
-    get_clf_time(datebuf, sizeof(datebuf)-1, &thetime);
-#else
-    strftime (datebuf, sizeof(datebuf), LOGGING_FORMAT_CLF, &thetime);
-#endif
+    logging_clf_date (datebuf, sizeof datebuf, time (NULL));
     /* This format MAY CHANGE OVER TIME.  We are looking into finding a good
        standard format for this, if you have any ideas, please let us know */
     log_write_direct (playlistlog, "%s|%s|%ld|%s",
@@ -281,6 +332,7 @@ int restart_logging (ice_config_t *config)
         log_set_lines_kept (config->error_log.logid, config->error_log.display);
         log_set_archive_timestamp (config->error_log.logid, config->error_log.archive);
         log_set_level (config->error_log.logid, config->error_log.level);
+        log_set_async (config->error_log.logid, config->error_log.async);
     }
     thread_use_log_id (config->error_log.logid);
     errorlog = config->error_log.logid; /* value stays static so avoid taking the config lock */
@@ -294,6 +346,7 @@ int restart_logging (ice_config_t *config)
         log_set_lines_kept (config->access_log.logid, config->access_log.display);
         log_set_archive_timestamp (config->access_log.logid, config->access_log.archive);
         log_set_level (config->access_log.logid, 4);
+        log_set_async (config->access_log.logid, config->access_log.async);
     }
 
     if (recheck_log_file (config, &config->playlist_log.logid, config->playlist_log.name) < 0)
@@ -319,6 +372,7 @@ int restart_logging (ice_config_t *config)
             log_set_lines_kept (m->access_log.logid, m->access_log.display);
             log_set_archive_timestamp (m->access_log.logid, m->access_log.archive);
             log_set_level (m->access_log.logid, 4);
+            log_set_async (m->access_log.logid, m->access_log.async);
         }
         m = m->next;
     }
@@ -328,6 +382,7 @@ int restart_logging (ice_config_t *config)
 
 int start_logging (ice_config_t *config)
 {
+    thread_mutex_create (&clf_date_lock);
     if (strcmp (config->error_log.name, "-") == 0)
         errorlog = log_open_file (stderr);
     if (strcmp(config->access_log.name, "-") == 0)
@@ -341,20 +341,38 @@ static int get_initial_frame (struct mpeg_sync *mp, unsigned char *p, unsigned r
     return ret;
 }
 
-/* return number from 1 to remaining */
-static int find_align_sync (mpeg_sync *mp, unsigned char *start, int remaining)
+/* locate the next possible frame start between p and end. memchr is used for
+ * the scan as C libraries have that vectorised, so runs of data without sync
+ * bytes are skipped quickly. When the fixed header bits are known then those
+ * are checked as well, a header cut short by the end of data is returned as
+ * it may be completed later.
+ */
+static unsigned char *find_sync_candidate (mpeg_sync *mp, unsigned char *p, unsigned char *end)
 {
-    int skip = 0;
-    unsigned char *p = start;
     if (mp->syncbytes)
-        p = memchr (start, mp->fixed_headerbits[0], remaining);
-    else
     {
-        int offset = remaining;
-        for (; offset && *p != 0xFF && *p != 0x47; offset--)
+        while (p < end && (p = memchr (p, mp->fixed_headerbits[0], end - p)) != NULL)
+        {
+            if (end - p < mp->syncbytes || memcmp (p, &mp->fixed_headerbits[0], mp->syncbytes) == 0)
+                return p;
             p++;
-        if (offset == 0) p = NULL;
+        }
+        return NULL;
+    }
+    else
+    {
+        unsigned char *ff = memchr (p, 0xFF, end - p);
+        unsigned char *ts = memchr (p, 0x47, (ff ? ff : end) - p);
+        return ts ? ts : ff;
     }
+}
+
+/* return number from 1 to remaining */
+static int find_align_sync (mpeg_sync *mp, unsigned char *start, int remaining)
+{
+    int skip = 0;
+    unsigned char *p = find_sync_candidate (mp, start, start + remaining);
+
     if (p)
     {
         skip = p - start;
@@ -375,11 +393,13 @@ int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
 {
     unsigned char *start, *end;
     int remaining, frame_len = 0, completed = 0;
+    uint64_t samples = 0;
 
     if (mp == NULL)
         return 0;  /* leave as-is */
     
     mp->sample_count = 0;
+    mp->duration = 0;
     if (mp->surplus)
     {
         if (offset >= mp->surplus->len)
@@ -435,14 +455,19 @@ int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
         }
         if (memcmp (start, &mp->fixed_headerbits[0], mp->syncbytes) != 0)
         {
-            memmove (start, start+1, remaining-1);
-            new_block->len--;
+            /* skip over to the next matching header in one go */
+            unsigned char *p = find_sync_candidate (mp, start+1, end);
+            int skip = p ? p - start : 1;
+
+            memmove (start, start+skip, remaining-skip);
+            new_block->len -= skip;
             continue;
         }
         frame_len = mp->process_frame (mp, start, remaining);
         if (frame_len <= 0)  // frame fragment at the end
             break;
         start += frame_len;
+        samples += mp->sample_count;
         completed++;
     }
     if (remaining < 0 || remaining > new_block->len)
@@ -451,6 +476,9 @@ int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
         abort();
     }
     new_block->len -= remaining;
+    /* the block may be shared, so only the caller can decide to use this */
+    if (mp->samplerate > 0)
+        mp->duration = (unsigned int)(samples * 1000000 / mp->samplerate);
     return remaining;
 }
 
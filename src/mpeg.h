@@ -23,6 +23,7 @@ typedef struct mpeg_sync
     int (*process_frame) (struct mpeg_sync *mp, unsigned char *p, int len);
     refbuf_t *surplus;
     long sample_count;
+    unsigned int duration;  /* us of audio in the last completed block */
     long resync_count;
     void *callback_key;
     int (*frame_callback)(struct mpeg_sync *mp, unsigned char *p, unsigned int len);
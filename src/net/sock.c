@@ -41,6 +41,10 @@
 #endif
 
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#endif
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
@@ -968,6 +972,46 @@ void sock_set_send_buffer (sock_t sock, int win_size)
     setsockopt (sock, SOL_SOCKET, SO_SNDBUF, (char *) &win_size, sizeof(win_size));
 }
 
+/* limit the amount of unsent data the kernel accepts before the socket stops
+ * being writable, returns -1 if not supported */
+int sock_set_notsent_lowat (sock_t sock, int bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    return setsockopt (sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void *)&bytes, sizeof(bytes));
+#else
+    return -1;
+#endif
+}
+
+/* have the kernel pace sending to rate bytes per second (needs the fq qdisc
+ * on linux), returns -1 if not supported */
+int sock_set_pacing_rate (sock_t sock, unsigned int rate)
+{
+#ifdef SO_MAX_PACING_RATE
+    return setsockopt (sock, SOL_SOCKET, SO_MAX_PACING_RATE, (void *)&rate, sizeof(rate));
+#else
+    return -1;
+#endif
+}
+
+/* amount of data written to the socket which the kernel still holds, -1
+ * if that cannot be determined */
+int sock_get_unsent (sock_t sock)
+{
+#if defined(SIOCOUTQ) || defined(TIOCOUTQ) || defined(FIONWRITE)
+    int queued = 0;
+#if defined(SIOCOUTQ)
+    if (ioctl (sock, SIOCOUTQ, &queued) == 0)
+#elif defined(TIOCOUTQ)
+    if (ioctl (sock, TIOCOUTQ, &queued) == 0)
+#else
+    if (ioctl (sock, FIONWRITE, &queued) == 0)
+#endif
+        return queued;
+#endif
+    return -1;
+}
+
 int sock_listen(sock_t serversock, int backlog)
 {
     if (!sock_valid_socket(serversock))
@@ -979,6 +1023,37 @@ int sock_listen(sock_t serversock, int backlog)
     return (listen(serversock, backlog) == 0);
 }
 
+/* create a unix domain socket at path for local clients, any stale socket
+ * file left at path is removed first.
+ */
+sock_t sock_get_unix_server_socket (const char *path)
+{
+#ifdef _WIN32
+    return SOCK_ERROR;
+#else
+    struct sockaddr_un sa;
+    sock_t sock;
+
+    if (path == NULL || strlen (path) >= sizeof (sa.sun_path))
+        return SOCK_ERROR;
+    memset (&sa, 0, sizeof (sa));
+    sa.sun_family = AF_UNIX;
+    strcpy (sa.sun_path, path);
+
+    sock = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (sock == SOCK_ERROR)
+        return SOCK_ERROR;
+    unlink (path);
+    if (bind (sock, (struct sockaddr *)&sa, sizeof (sa)) < 0)
+    {
+        sock_close (sock);
+        return SOCK_ERROR;
+    }
+    return sock;
+#endif
+}
+
+
 sock_t sock_accept(sock_t serversock, char *ip, size_t len)
 {
 #ifdef HAVE_GETNAMEINFO
@@ -996,6 +1071,12 @@ sock_t sock_accept(sock_t serversock, char *ip, size_t len)
     {
         if (ip)
         {
+#ifndef _WIN32
+            /* local clients are treated as coming from the loopback address */
+            if (((struct sockaddr *)&sa)->sa_family == AF_UNIX)
+                snprintf (ip, len, "127.0.0.1");
+            else
+#endif
 #ifdef HAVE_GETNAMEINFO
             if (getnameinfo ((struct sockaddr *)&sa, slen, ip, len, NULL, 0, NI_NUMERICHOST))
                 snprintf (ip, len, "unknown");
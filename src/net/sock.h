@@ -95,8 +95,12 @@ ssize_t sock_writev (sock_t sock, WSABUF *iov, size_t count);
 # define sock_read_bytes _mangle(sock_read_bytes)
 # define sock_read_line _mangle(sock_read_line)
 # define sock_get_server_socket _mangle(sock_get_server_socket)
+# define sock_get_unix_server_socket _mangle(sock_get_unix_server_socket)
 # define sock_listen _mangle(sock_listen)
 # define sock_set_send_buffer _mangle(sock_set_send_buffer)
+# define sock_set_notsent_lowat _mangle(sock_set_notsent_lowat)
+# define sock_get_unsent _mangle(sock_get_unsent)
+# define sock_set_pacing_rate _mangle(sock_set_pacing_rate)
 # define sock_accept _mangle(sock_accept)
 # define sock_create_pipe_emulation _mangle(sock_create_pipe_emulation)
 #endif
@@ -115,6 +119,9 @@ int sock_set_nolinger(sock_t sock);
 int sock_set_keepalive(sock_t sock);
 int sock_set_nodelay(sock_t sock);
 void sock_set_send_buffer (sock_t sock, int win_size);
+int sock_set_notsent_lowat (sock_t sock, int bytes);
+int sock_get_unsent (sock_t sock);
+int sock_set_pacing_rate (sock_t sock, unsigned int rate);
 int sock_set_delay(sock_t sock);
 void sock_set_error(int val);
 int sock_close(sock_t  sock);
@@ -141,6 +148,7 @@ int sock_read_pending(sock_t sock, unsigned timeout);
 
 /* server socket functions */
 sock_t sock_get_server_socket(int port, const char *sinterface);
+sock_t sock_get_unix_server_socket(const char *path);
 int sock_listen(sock_t serversock, int backlog);
 sock_t sock_accept(sock_t serversock, char *ip, size_t len);
 
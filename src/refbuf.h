@@ -28,6 +28,7 @@ typedef struct _refbuf_tag
     struct _refbuf_tag *associated;
     char *data;
     unsigned int len;
+    unsigned int duration;  /* media time in the block in usecs, 0 if unknown */
 
 } refbuf_t;
 
@@ -1041,7 +1041,8 @@ static void slave_startup (void)
     redirector_setup (config);
     update_master_as_slave (config);
     stats_global (config);
-    workers_adjust (config->workers_count);
+    workers_set_cpus (config->worker_cpus);
+    workers_set_range (config->workers_count, config->workers_max);
     yp_initialize (config);
     config_release_config();
 
@@ -1100,6 +1101,7 @@ static void _slave_thread(void)
             }
         }
         stats_global_calc();
+        workers_check_load ();
         thread_sleep (1000000);
     }
     connection_thread_shutdown();
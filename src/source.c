@@ -22,6 +22,7 @@
 #include <limits.h>
 #endif
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <ogg/ogg.h>
 #include <errno.h>
 
@@ -38,9 +39,11 @@
 #include "avl/avl.h"
 #include "httpp/httpp.h"
 #include "net/sock.h"
+#include "timing/timing.h"
 
 #include "connection.h"
 #include "global.h"
+#include "md5.h"
 #include "refbuf.h"
 #include "client.h"
 #include "stats.h"
@@ -59,10 +62,48 @@
 
 #define MAX_FALLBACK_DEPTH 10
 
+/* amount of data a caught up listener should have waiting before waking up */
+#define LISTENER_SEND_SIZE      5600
+#define LISTENER_LATENCY        150
+#define LISTENER_SKIP_WAIT      3
+#define INTRO_LOAD_LIMIT        (2*1024*1024)
+#define INTRO_RECHECK           10
+
+/* limit on the data waiting to be written to a dump file */
+#define DUMPFILE_QUEUE_LIMIT    (2*1024*1024)
+/* writes to a dump file done later than this (ms) are counted as late */
+#define DUMPFILE_LATE_MS        2000
+#define DUMPFILE_BUFFER_SIZE    65536
+
+/* a copy of the data is taken, as some listeners (eg FLV) alter the queue
+ * blocks, and the dump thread does not take the source lock */
+struct dump_block
+{
+    struct dump_block *next;
+    uint64_t queued_ms;
+    unsigned int len;
+    char *data;
+};
+
+struct dump_file_tag
+{
+    mutex_t lock;
+    FILE *fp;
+    char *mount;
+    struct dump_block *head, **tailp;
+    unsigned int queued;
+    unsigned long dropped, late;
+    int running;
+    int closing;
+    int error;
+};
+
 
 /* avl tree helper */
 static void _parse_audio_info (source_t *source, const char *s);
 static void source_client_release (client_t *client);
+static void source_release_intro (source_t *source);
+static void source_load_intro (source_t *source);
 static int  source_listener_release (source_t *source, client_t *client);
 static int  source_client_read (client_t *client);
 static int  source_client_shutdown (client_t *client);
@@ -75,6 +116,11 @@ static int  wait_for_other_listeners (client_t *client);
 static int  http_source_listener (client_t *client);
 static int  http_source_intro (client_t *client);
 static int  locate_start_on_queue (source_t *source, client_t *client);
+static refbuf_t *locate_latest_sync (source_t *source, long *lagp);
+static int  listener_pacing_delay (source_t *source, long lag);
+static unsigned int source_queue_limit (source_t *source);
+static void source_add_queue_buffer (source_t *source, refbuf_t *refbuf);
+static void source_flush_coalesced (source_t *source);
 static int  listener_change_worker (client_t *client, source_t *source);
 static int  source_change_worker (source_t *source);
 static int  source_client_callback (client_t *client);
@@ -251,10 +297,13 @@ void source_clear_source (source_t *source)
 
     DEBUG1 ("clearing source \"%s\"", source->mount);
 
+    /* any merged data goes on the queue, and to the dumpfile */
+    if (source->client)
+        source_flush_coalesced (source);
     if (source->dumpfile)
     {
         INFO1 ("Closing dumpfile for %s", source->mount);
-        fclose (source->dumpfile);
+        dumpfile_close (source->dumpfile);
         source->dumpfile = NULL;
     }
 
@@ -282,7 +331,12 @@ void source_clear_source (source_t *source)
     source->min_queue_point = NULL;
     source->stream_data = NULL;
     source->stream_data_tail = NULL;
+    refbuf_release (source->coalesce_block);
+    source->coalesce_block = NULL;
+    /* queue positions are not valid for a new stream */
+    memset (source->resume, 0, sizeof (source->resume));
 
+    global_queue_memory (-(long)source->queue_size);
     source->min_queue_size = 0;
     source->min_queue_offset = 0;
     source->default_burst_size = 0;
@@ -295,11 +349,9 @@ void source_clear_source (source_t *source)
     free(source->dumpfilename);
     source->dumpfilename = NULL;
 
-    if (source->intro_file)
-    {
-        fclose (source->intro_file);
-        source->intro_file = NULL;
-    }
+    free (source->intro_filename);
+    source->intro_filename = NULL;
+    source_release_intro (source);
 }
 
 
@@ -373,6 +425,9 @@ static void update_source_stats (source_t *source)
     stats_set_args (source->stats, "total_mbytes_sent",
             "%"PRIu64, source->format->sent_bytes/(1024*1024));
     stats_set_args (source->stats, "queue_size", "%u", source->queue_size);
+    stats_set_args (source->stats, "queue_limit", "%u", source_queue_limit (source));
+    stats_set_args (source->stats, "max_unsent", "%d", source->max_unsent);
+    source->max_unsent = 0;
     if (source->client->connection.con_time)
     {
         worker_t *worker = source->client->worker;
@@ -389,6 +444,158 @@ static void update_source_stats (source_t *source)
 }
 
 
+/* work out how much data the queue can hold. When the server-wide queue memory
+ * budget is getting full, mounts without listeners only keep their burst data
+ * and when nearly exhausted all queues are cut, which drops the listeners that
+ * are furthest behind first.
+ */
+static unsigned int source_queue_limit (source_t *source)
+{
+    unsigned int limit = source->queue_size_limit, trimmed = source->min_queue_size + 40000;
+
+    if (global.queue_pressure > 1 && trimmed < limit)
+    {
+        if (source->listeners == 0)
+            limit = trimmed;
+        else if (global.queue_pressure > 2)
+            limit = (limit + trimmed) / 2;
+    }
+    return limit;
+}
+
+
+/* append the provided buffer to the end of the queue, the burst point for new
+ * listeners is moved along and the buffer is passed to the dump file.
+ */
+static void source_add_queue_buffer (source_t *source, refbuf_t *refbuf)
+{
+    refbuf->flags |= SOURCE_QUEUE_BLOCK;
+    /* the latest refbuf is counted twice so that it stays */
+    refbuf_addref (refbuf);
+
+    /* append buffer to the in-flight data queue,  */
+    if (source->stream_data == NULL)
+    {
+        source->stream_data = refbuf;
+        source->min_queue_point = refbuf;
+        source->min_queue_offset = 0;
+    }
+    if (source->stream_data_tail)
+    {
+        if (source->min_queue_offset > source->min_queue_size)
+        {
+            ERROR3 ("queue oddity, stream %s, %d, %d", source->mount, source->min_queue_offset, source->min_queue_size);
+            source->flags &= ~SOURCE_RUNNING;
+        }
+        source->stream_data_tail->next = refbuf;
+        refbuf_release (source->stream_data_tail);
+    }
+    source->stream_data_tail = refbuf;
+    source->queue_size += refbuf->len;
+
+    /* increase refcount for keeping burst data */
+    refbuf_addref (refbuf);
+
+    /* move the starting point for new listeners */
+    source->min_queue_offset += refbuf->len;
+    while (source->min_queue_offset > source->min_queue_size)
+    {
+        refbuf_t *to_release = source->min_queue_point;
+        if (to_release && to_release->next)
+        {
+            source->min_queue_offset -= to_release->len;
+            source->min_queue_point = to_release->next;
+            refbuf_release (to_release);
+            continue;
+        }
+        if (source->min_queue_point != refbuf)
+        {
+            ERROR0 ("weird state of min_queue point");
+            abort();
+        }
+        break;
+    }
+
+    /* save stream to file */
+    if (source->dumpfile && source->format->write_buf_to_file)
+        source->format->write_buf_to_file (source, refbuf);
+}
+
+
+/* hold on to small blocks and merge them with following ones, so that
+ * listeners do fewer sends for the same data. The merged block takes the
+ * flags of the first block in it. A change of associated data (eg metadata)
+ * starts a new block, as does the latency bound expiring. Blocks that the
+ * format may mark as a sync point later on are never merged.
+ */
+static void source_coalesce_block (source_t *source, refbuf_t *refbuf)
+{
+    refbuf_t *pending = source->coalesce_block;
+
+    if (pending && ((refbuf->flags & SOURCE_BLOCK_NOMERGE) ||
+                refbuf->associated != pending->associated ||
+                pending->len + refbuf->len > source->coalesce_size))
+    {
+        source_flush_coalesced (source);
+        pending = NULL;
+    }
+    if (pending == NULL)
+    {
+        if (refbuf->len >= source->coalesce_size / 2 || (refbuf->flags & SOURCE_BLOCK_NOMERGE))
+        {
+            source_add_queue_buffer (source, refbuf);
+            return;
+        }
+        pending = refbuf_new (source->coalesce_size);
+        pending->len = 0;
+        pending->flags = refbuf->flags;
+        pending->associated = refbuf->associated;
+        refbuf_addref (pending->associated);
+        source->coalesce_block = pending;
+        source->coalesce_expire = source->client->worker->time_ms + source->coalesce_latency;
+    }
+    memcpy (pending->data + pending->len, refbuf->data, refbuf->len);
+    pending->len += refbuf->len;
+    pending->duration += refbuf->duration;
+    /* the data is not on the queue yet so listeners should not count it */
+    source->client->queue_pos -= refbuf->len;
+    refbuf_release (refbuf);
+}
+
+
+/* place any merged block onto the queue */
+static void source_flush_coalesced (source_t *source)
+{
+    refbuf_t *pending = source->coalesce_block;
+
+    if (pending == NULL)
+        return;
+    source->coalesce_block = NULL;
+    source->client->queue_pos += pending->len;
+    source_add_queue_buffer (source, pending);
+}
+
+
+/* reschedule the listeners on this worker to run now, used when new data
+ * should not wait for the listeners normal wakeup.
+ */
+static void source_wake_listeners (source_t *source)
+{
+    worker_t *worker = source->client->worker;
+    avl_node *node = avl_get_first (source->clients);
+
+    while (node)
+    {
+        client_t *client = (client_t *)node->key;
+
+        if (client->worker == worker && client->schedule_ms > worker->time_ms)
+            client->schedule_ms = worker->time_ms;
+        node = avl_get_next (node);
+    }
+    worker->wakeup_ms = worker->time_ms;
+}
+
+
 /* get some data from the source. The stream data is placed in a refbuf
  * and sent back, however NULL is also valid as in the case of a short
  * timeout and there's no data pending.
@@ -400,9 +607,12 @@ int source_read (source_t *source)
     int skip = 1, loop = 2;
     time_t current = client->worker->current_time.tv_sec;
     int fds = 0;
+    unsigned int queue_size = source->queue_size;
 
     if (global.running != ICE_RUNNING)
         source->flags &= ~SOURCE_RUNNING;
+    if (source->intro_filename && current >= source->intro_recheck)
+        source_load_intro (source);
     do
     {
         if (source->flags & SOURCE_LISTENERS_SYNC)
@@ -446,6 +656,8 @@ int source_read (source_t *source)
             if (source_change_worker (source))
                 return 1;
         }
+        if (source->coalesce_block && client->worker->time_ms >= source->coalesce_expire)
+            source_flush_coalesced (source);
         fds = util_timed_wait_for_fd (client->connection.sock, 0);
         if (fds < 0)
         {
@@ -487,56 +699,10 @@ int source_read (source_t *source)
             {
                 source->bytes_read_since_update += refbuf->len;
 
-                refbuf->flags |= SOURCE_QUEUE_BLOCK;
-                /* the latest refbuf is counted twice so that it stays */
-                refbuf_addref (refbuf);
-
-                /* append buffer to the in-flight data queue,  */
-                if (source->stream_data == NULL)
-                {
-                    source->stream_data = refbuf;
-                    source->min_queue_point = refbuf;
-                    source->min_queue_offset = 0;
-                }
-                if (source->stream_data_tail)
-                {
-                    if (source->min_queue_offset > source->min_queue_size)
-                    {
-                        ERROR3 ("queue oddity, stream %s, %d, %d", source->mount, source->min_queue_offset, source->min_queue_size);
-                        source->flags &= ~SOURCE_RUNNING;
-                    }
-                    source->stream_data_tail->next = refbuf;
-                    refbuf_release (source->stream_data_tail);
-                }
-                source->stream_data_tail = refbuf;
-                source->queue_size += refbuf->len;
-
-                /* increase refcount for keeping burst data */
-                refbuf_addref (refbuf);
-
-                /* move the starting point for new listeners */
-                source->min_queue_offset += refbuf->len;
-                while (source->min_queue_offset > source->min_queue_size)
-                {
-                    refbuf_t *to_release = source->min_queue_point;
-                    if (to_release && to_release->next)
-                    {
-                        source->min_queue_offset -= to_release->len;
-                        source->min_queue_point = to_release->next;
-                        refbuf_release (to_release);
-                        continue;
-                    }
-                    if (source->min_queue_point != refbuf)
-                    {
-                        ERROR0 ("weird state of min_queue point");
-                        abort();
-                    }
-                    break;
-                }
-
-                /* save stream to file */
-                if (source->dumpfile && source->format->write_buf_to_file)
-                    source->format->write_buf_to_file (source, refbuf);
+                if (source->coalesce_size)
+                    source_coalesce_block (source, refbuf);
+                else
+                    source_add_queue_buffer (source, refbuf);
                 skip = 0;
             }
             else
@@ -552,8 +718,12 @@ int source_read (source_t *source)
             loop--;
         } while (loop);
 
+        /* listeners get new data straight away in low latency mode */
+        if (skip == 0 && source->low_latency)
+            source_wake_listeners (source);
+
         /* lets see if we have too much data in the queue */
-        while (source->queue_size > source->queue_size_limit ||
+        while (source->queue_size > source_queue_limit (source) ||
                 (source->stream_data && source->stream_data->_count == 1))
         {
             refbuf_t *to_go = source->stream_data;
@@ -566,6 +736,8 @@ int source_read (source_t *source)
         }
     } while (0);
 
+    if (source->queue_size != queue_size)
+        global_queue_memory ((long)source->queue_size - (long)queue_size);
     if (skip)
         client->schedule_ms += (source->skip_duration | 0xF);
     else
@@ -659,9 +831,26 @@ static int source_queue_advance (client_t *client)
     /* move to the next buffer if we have finished with the current one */
     if (client->pos >= refbuf->len)
     {
+        if ((client->flags & CLIENT_SKIP_PENDING) && source->stream_data_tail)
+        {
+            long lag;
+            refbuf_t *latest = locate_latest_sync (source, &lag);
+
+            client->flags &= ~CLIENT_SKIP_PENDING;
+            stats_event_inc (source->mount, "listener_skips");
+            client_set_queue (client, latest);
+            client->intro_offset = -1;
+            client->queue_pos = source->client->queue_pos - lag;
+            return source->format->write_buf_to_client (client);
+        }
         if (refbuf->next == NULL)
         {
-            client->schedule_ms = source->client->schedule_ms + 5;
+            int delay = listener_pacing_delay (source, 0);
+
+            if (delay)
+                client->schedule_ms = client->worker->time_ms + delay;
+            else
+                client->schedule_ms = source->client->schedule_ms + 5;
             return -1;
         }
         client_set_queue (client, refbuf->next);
@@ -670,6 +859,113 @@ static int source_queue_advance (client_t *client)
 }
 
 
+/* media time in usecs held in the block, estimated from the incoming rate
+ * if the format has not marked it.
+ */
+static unsigned int block_duration (source_t *source, refbuf_t *refbuf)
+{
+    if (refbuf->duration)
+        return refbuf->duration;
+    if (source->incoming_rate > 0)
+        return (unsigned int)((uint64_t)refbuf->len * 1000000 / source->incoming_rate);
+    return 0;
+}
+
+
+/* build the resume token for a connection id, the id is followed by a hash of
+ * the id and the server secret so that tokens of other listeners cannot be
+ * worked out from the id alone.
+ */
+static void source_resume_token (unsigned long id, char *buf, unsigned int len)
+{
+    struct MD5Context context;
+    unsigned char digest [HASH_LEN];
+    char idstr [24];
+    int i, n = snprintf (idstr, sizeof idstr, "%lu", id);
+
+    MD5Init (&context);
+    MD5Update (&context, global.resume_secret, sizeof (global.resume_secret));
+    MD5Update (&context, (unsigned char *)idstr, n);
+    MD5Final (digest, &context);
+
+    n = snprintf (buf, len, "%s-", idstr);
+    for (i = 0; i < 8 && n + 2 < (int)len; i++, n += 2)
+        snprintf (buf + n, len - n, "%02x", digest [i]);
+}
+
+
+/* check for a listener giving the resume token of an earlier connection, if
+ * that position is still on the queue then the start point is the next sync
+ * point after it. Returns 0 if a start point is found
+ */
+static int locate_resume_point (source_t *source, client_t *client, refbuf_t **startp, long *lagp)
+{
+    const char *token;
+    struct source_resume *slot;
+    unsigned long id;
+    char expected [48];
+
+    if (client->flags & CLIENT_RESUME_CHECKED)
+        return -1;
+    client->flags |= CLIENT_RESUME_CHECKED;
+    token = httpp_get_query_param (client->parser, "resume");
+    if (token == NULL)
+        token = httpp_getvar (client->parser, "x-resume-token");
+    if (token == NULL)
+        return -1;
+
+    id = strtoul (token, NULL, 10);
+    slot = &source->resume [id % SOURCE_RESUME_SLOTS];
+    source_resume_token (id, expected, sizeof expected);
+    if (id && slot->id == id && strcmp (token, expected) == 0)
+    {
+        uint64_t pos = source->client->queue_pos - source->queue_size;
+        refbuf_t *refbuf = source->stream_data;
+
+        slot->id = 0;
+        if (slot->queue_pos < pos)
+            refbuf = NULL;  /* position has already left the queue */
+        while (refbuf)
+        {
+            if (pos >= slot->queue_pos && (refbuf->flags & SOURCE_BLOCK_SYNC))
+            {
+                *startp = refbuf;
+                *lagp = (long)(source->client->queue_pos - pos);
+                stats_event_inc (source->mount, "resume_hits");
+                return 0;
+            }
+            pos += refbuf->len;
+            refbuf = refbuf->next;
+        }
+    }
+    stats_event_inc (source->mount, "resume_misses");
+    return -1;
+}
+
+
+/* find the most recent sync point in the burst data, or the last block if
+ * there is none. lag is set to the amount of queued data from that block.
+ */
+static refbuf_t *locate_latest_sync (source_t *source, long *lagp)
+{
+    refbuf_t *refbuf = source->min_queue_point, *sync = source->stream_data_tail;
+    long lag = source->min_queue_offset;
+
+    *lagp = sync->len;
+    while (refbuf)
+    {
+        if (refbuf->flags & SOURCE_BLOCK_SYNC)
+        {
+            sync = refbuf;
+            *lagp = lag;
+        }
+        lag -= refbuf->len;
+        refbuf = refbuf->next;
+    }
+    return sync;
+}
+
+
 static int locate_start_on_queue (source_t *source, client_t *client)
 {
     refbuf_t *refbuf;
@@ -685,25 +981,63 @@ static int locate_start_on_queue (source_t *source, client_t *client)
     {
         lag = refbuf->len;
     }
+    else if (locate_resume_point (source, client, &refbuf, &lag) == 0)
+    {
+        DEBUG2 ("client %lu resuming on %s", client->connection.id, source->mount);
+    }
     else
     {
         const char *header = httpp_getvar (client->parser, "initial-burst");
         const char *arg = httpp_get_query_param (client->parser, "burst");
+        const char *burst = arg ? arg : header;
         size_t size = source->min_queue_size;
         off_t v = source->default_burst_size;
-        if (arg)
-            v = atol (arg);
-        else if (header)
-            v = atol (header);
-        v -= client->connection.sent_bytes; /* have we sent data already */
+        long ms = source->default_burst_duration;
+
+        if (burst)
+        {
+            char *end = NULL;
+            v = strtol (burst, &end, 10);
+            ms = 0;
+            if (end && strcmp (end, "ms") == 0)
+                ms = (long)v;  /* burst is requested as a duration */
+        }
         refbuf = source->min_queue_point;
         lag = source->min_queue_offset;
-        // DEBUG3 ("size %lld, v %lld, lag %ld", size, v, lag);
-        while (size > v && refbuf && refbuf->next)
+        if (burst == NULL && source->low_latency)
+            refbuf = locate_latest_sync (source, &lag);
+        else if (ms > 0)
         {
-            size -= refbuf->len;
-            lag -= refbuf->len;
-            refbuf = refbuf->next;
+            uint64_t duration = 0;
+            refbuf_t *r;
+
+            if (global.queue_pressure)
+                ms >>= global.queue_pressure;
+            if (source->incoming_rate > 0)
+                ms -= (long)(client->connection.sent_bytes * 1000 / source->incoming_rate);
+            if (ms < 0)
+                ms = 0;
+            for (r = refbuf; r; r = r->next)
+                duration += block_duration (source, r);
+            while (duration > (uint64_t)ms * 1000 && refbuf && refbuf->next)
+            {
+                duration -= block_duration (source, refbuf);
+                lag -= refbuf->len;
+                refbuf = refbuf->next;
+            }
+        }
+        else
+        {
+            if (global.queue_pressure)
+                v >>= global.queue_pressure;  /* queue memory is short, reduce burst */
+            v -= client->connection.sent_bytes; /* have we sent data already */
+            // DEBUG3 ("size %lld, v %lld, lag %ld", size, v, lag);
+            while (size > v && refbuf && refbuf->next)
+            {
+                size -= refbuf->len;
+                lag -= refbuf->len;
+                refbuf = refbuf->next;
+            }
         }
         if (lag < 0)
             ERROR1 ("Odd, lag is negative", lag);
@@ -727,23 +1061,146 @@ static int locate_start_on_queue (source_t *source, client_t *client)
 }
 
 
+/* the intro blocks are shared by listeners, so only drop the links between
+ * them, any listener still on one of them will then move on to the stream.
+ */
+static void source_release_intro (source_t *source)
+{
+    refbuf_t *refbuf = source->intro_file;
+
+    while (refbuf)
+    {
+        refbuf_t *next = refbuf->next;
+
+        refbuf->next = NULL;
+        refbuf_release (refbuf);
+        refbuf = next;
+    }
+    source->intro_file = NULL;
+    if (source->intro_fp)
+        fclose (source->intro_fp);
+    source->intro_fp = NULL;
+}
+
+
+/* read the intro file into blocks if it has changed since the last load, or
+ * leave it open if too large to hold in memory. Called by the source client
+ * with the source lock held, the lock is dropped while reading as the file
+ * may be large or slow to read.
+ */
+static void source_load_intro (source_t *source)
+{
+    char *path = strdup (source->intro_filename);
+    time_t mtime = source->intro_mtime;
+    refbuf_t *intro = NULL, *refbuf;
+    FILE *f = NULL, *intro_fp = NULL;
+    struct stat st;
+
+    source->intro_recheck = source->client->worker->current_time.tv_sec + INTRO_RECHECK;
+    thread_mutex_unlock (&source->lock);
+    if (path == NULL || (stat (path, &st) == 0 ? st.st_mtime == mtime : mtime == (time_t)-1))
+    {
+        thread_mutex_lock (&source->lock);
+        free (path);
+        return;
+    }
+    if (mtime)
+        INFO1 ("reloading intro file \"%s\"", path);
+    f = fopen (path, "rb");
+    if (f == NULL)
+        WARN2 ("Cannot open intro file \"%s\": %s", path, strerror(errno));
+    else if (fseek (f, 0, SEEK_END) == 0 && ftell (f) > INTRO_LOAD_LIMIT)
+    {
+        INFO2 ("intro file \"%s\" is over %d bytes, reading it for each listener", path, INTRO_LOAD_LIMIT);
+        intro_fp = f;
+    }
+    else
+    {
+        rewind (f);
+        intro = format_file_load (source->format, f);
+        fclose (f);
+    }
+    for (refbuf = intro; refbuf; refbuf = refbuf->next)
+        refbuf->flags |= SOURCE_BLOCK_INTRO;
+    thread_mutex_lock (&source->lock);
+    if (source->intro_filename && strcmp (source->intro_filename, path) == 0)
+    {
+        source_release_intro (source);
+        source->intro_file = intro;
+        source->intro_fp = intro_fp;
+        source->intro_mtime = f ? st.st_mtime : (time_t)-1;
+    }
+    else
+    {
+        /* setting changed while loading, the new file is loaded next time */
+        while (intro)
+        {
+            refbuf = intro->next;
+            intro->next = NULL;
+            refbuf_release (intro);
+            intro = refbuf;
+        }
+        if (intro_fp)
+            fclose (intro_fp);
+    }
+    free (path);
+}
+
+
 static int http_source_introfile (client_t *client)
 {
     source_t *source = client->shared_data;
+    refbuf_t *refbuf = client->refbuf;
 
     //DEBUG2 ("client intro_pos is %ld, sent bytes is %ld", client->intro_offset, client->connection.sent_bytes);
-    if (format_file_read (client, source->format, source->intro_file) < 0)
+    if (source->intro_fp)
     {
-        if (source->stream_data_tail)
-        {
-            /* better find the right place in queue for this client */
+        /* a large intro file is read into a buffer for this client, a block
+         * from a previous loaded intro is shared so cannot be used for that */
+        if (refbuf && (refbuf->flags & SOURCE_BLOCK_INTRO))
             client_set_queue (client, NULL);
-            client->check_buffer = source_queue_advance;
-            return source_queue_advance (client);
+        if (format_file_read (client, source->format, source->intro_fp) < 0)
+        {
+            if (source->stream_data_tail)
+            {
+                /* better find the right place in queue for this client */
+                client_set_queue (client, NULL);
+                client->check_buffer = source_queue_advance;
+                return source_queue_advance (client);
+            }
+            client->schedule_ms += 100;
+            client->intro_offset = 0;  /* replay intro file */
+            return -1;
         }
-        client->schedule_ms += 100;
-        client->intro_offset = 0;  /* replay intro file */
-        return -1;
+        return source->format->write_buf_to_client (client);
+    }
+    if (client->flags & CLIENT_HAS_INTRO_CONTENT)
+    {
+        if (format_file_read (client, source->format, NULL) == 0)
+            return source->format->write_buf_to_client (client);
+        client->intro_offset = 0;
+        refbuf = NULL;
+    }
+    if (refbuf == NULL || client->pos >= refbuf->len)
+    {
+        /* intro_offset is 0 until the client is on the intro blocks */
+        refbuf_t *next = (refbuf && client->intro_offset) ? refbuf->next : source->intro_file;
+
+        if (next == NULL)
+        {
+            if (source->stream_data_tail)
+            {
+                /* better find the right place in queue for this client */
+                client_set_queue (client, NULL);
+                client->check_buffer = source_queue_advance;
+                return source_queue_advance (client);
+            }
+            client->schedule_ms += 100;
+            client->intro_offset = 0;  /* replay intro file */
+            return -1;
+        }
+        client_set_queue (client, next);
+        client->intro_offset += next->len;
     }
     return source->format->write_buf_to_client (client);
 }
@@ -764,6 +1221,34 @@ static int http_source_intro (client_t *client)
 }
 
 
+/* insert a header giving the token that a listener can use to resume from
+ * the same position if it reconnects.
+ */
+static void source_add_resume_header (client_t *client)
+{
+    refbuf_t *refbuf = client->refbuf;
+    char hdr [80], token [48], *data = refbuf->data;
+    unsigned int i, len;
+
+    source_resume_token (client->connection.id, token, sizeof token);
+    len = snprintf (hdr, sizeof hdr, "X-Resume-Token: %s\r\n", token);
+
+    if (refbuf->len + len > PER_CLIENT_REFBUF_SIZE)
+        return;
+    for (i = 0; i + 3 < refbuf->len; i++)
+    {
+        if (memcmp (data + i, "\r\n\r\n", 4) == 0)
+        {
+            i += 2;
+            memmove (data + i + len, data + i, refbuf->len - i);
+            memcpy (data + i, hdr, len);
+            refbuf->len += len;
+            break;
+        }
+    }
+}
+
+
 static int http_source_listener (client_t *client)
 {
     refbuf_t *refbuf = client->refbuf;
@@ -799,6 +1284,7 @@ static int http_source_listener (client_t *client)
             ERROR0 ("internal problem, dropping client");
             return -1;
         }
+        source_add_resume_header (client);
         stats_event_inc (source->mount, "listener_connections");
     }
     ret = format_generic_write_to_client (client);
@@ -955,6 +1441,57 @@ int listener_waiting_on_source (source_t *source, client_t *client)
 }
 
 
+/* work out how long a listener with lag bytes waiting can sleep before there
+ * is a worthwhile amount of data to send, based on the incoming rate and
+ * limited by the latency allowed for the mount. 0 means no delay.
+ */
+static int listener_pacing_delay (source_t *source, long lag)
+{
+    long wanted = LISTENER_SEND_SIZE - lag;
+    long delay;
+
+    if (source->listener_latency == 0 || source->incoming_rate <= 0 || wanted <= 0)
+        return 0;
+    delay = wanted * 1000 / source->incoming_rate;
+    if (delay > source->listener_latency)
+        delay = source->listener_latency;
+    return (int)delay;
+}
+
+
+/* listener is too far behind the stream, either move it on to recent data
+ * or drop it. returns -1 if dropped
+ */
+static int listener_fallen_behind (source_t *source, client_t *client)
+{
+    if (client->flags & CLIENT_SKIP_PENDING)
+    {
+        /* the skip happens at the end of the current block, a listener that
+         * is still on a block released from the queue after a few seconds
+         * is dropped rather than keeping the block */
+        if (client->refbuf == NULL || (client->refbuf->flags & SOURCE_BLOCK_RELEASE) == 0 ||
+                client->worker->current_time.tv_sec < client->skip_expire)
+            return 0;
+    }
+    else if (client->skips < source->slow_listener_skips && source->stream_data_tail)
+    {
+        /* rather than dropping, jump ahead to recent data once the current
+         * block is done, as the format may be part way through framing it */
+        client->skips++;
+        client->flags |= CLIENT_SKIP_PENDING;
+        client->skip_expire = client->worker->current_time.tv_sec + LISTENER_SKIP_WAIT;
+        INFO4 ("Client %lu (%s) has fallen too far behind on %s, skipping ahead (%u)",
+                client->connection.id, client->connection.ip, source->mount, client->skips);
+        return 0;
+    }
+    INFO3 ("Client %lu (%s) has fallen too far behind on %s, removing",
+            client->connection.id, client->connection.ip, source->mount);
+    stats_event_inc (source->mount, "slow_listeners");
+    client_set_queue (client, NULL);
+    return -1;
+}
+
+
 static int send_listener (source_t *source, client_t *client)
 {
     int bytes;
@@ -989,6 +1526,29 @@ static int send_listener (source_t *source, client_t *client)
 
     lag = source->client->queue_pos - client->queue_pos;
 
+    /* see how much the kernel is holding for this listener, that is also lag.
+     * Only for listeners on the queue, headers and intro have no queue position */
+    if (source->notsent_lowat && client->check_buffer == source_queue_advance &&
+            client->worker->current_time.tv_sec >= client->unsent_check)
+    {
+        client->unsent = sock_get_unsent (client->connection.sock);
+        client->unsent_check = client->worker->current_time.tv_sec + 1;
+        if (client->unsent > source->max_unsent)
+            source->max_unsent = client->unsent;
+        if (client->refbuf && client->unsent > 0 &&
+                lag + client->unsent > (long)source_queue_limit (source))
+            return listener_fallen_behind (source, client);
+    }
+    /* caught up listeners wait until there is enough to be worth a send */
+    if (client->refbuf && lag < LISTENER_SEND_SIZE)
+    {
+        int delay = listener_pacing_delay (source, lag);
+        if (delay > 5)
+        {
+            client->schedule_ms = client->worker->time_ms + delay;
+            return 0;
+        }
+    }
     if (source->incoming_rate && lag < source->incoming_rate)
         limiter = source->incoming_rate/2;
 
@@ -1041,17 +1601,163 @@ static int send_listener (source_t *source, client_t *client)
     /* the refbuf referenced at head (last in queue) may be marked for deletion
      * if so, check to see if this client is still referring to it */
     if (client->refbuf && (client->refbuf->flags & SOURCE_BLOCK_RELEASE))
+        return listener_fallen_behind (source, client);
+    return ret;
+}
+
+
+static void dumpfile_free (dump_file_t *dump)
+{
+    if (dump->dropped || dump->late)
+        INFO3 ("dumpfile for %s had %lu blocks dropped, %lu written late",
+                dump->mount, dump->dropped, dump->late);
+    fclose (dump->fp);
+    thread_mutex_destroy (&dump->lock);
+    free (dump->mount);
+    free (dump);
+}
+
+
+/* dump file writes are done on a separate thread, started when data is
+ * queued and exiting when the queue has been empty for a short while, so
+ * that a slow disk does not hold up the worker the source is on.
+ */
+static void *dumpfile_thread (void *arg)
+{
+    dump_file_t *dump = arg;
+    int closing, idle = 0;
+
+    thread_mutex_lock (&dump->lock);
+    while (1)
     {
-        INFO3 ("Client %lu (%s) has fallen too far behind on %s, removing",
-                client->connection.id, client->connection.ip, source->mount);
-        stats_event_inc (source->mount, "slow_listeners");
-        client_set_queue (client, NULL);
-        ret = -1;
+        struct dump_block *block = dump->head;
+        unsigned int written = 0;
+        uint64_t late_ms = timing_get_time() - DUMPFILE_LATE_MS;
+        int error = dump->error;
+
+        if (block == NULL)
+        {
+            if (dump->closing || ++idle > 5)
+                break;
+            thread_mutex_unlock (&dump->lock);
+            thread_sleep (200000);
+            thread_mutex_lock (&dump->lock);
+            continue;
+        }
+        idle = 0;
+        dump->head = NULL;
+        dump->tailp = &dump->head;
+        thread_mutex_unlock (&dump->lock);
+
+        while (block)
+        {
+            struct dump_block *next = block->next;
+
+            if (error == 0 && fwrite (block->data, 1, block->len, dump->fp) != block->len)
+                error = 1;
+            if (block->queued_ms < late_ms)
+                dump->late++;
+            written += block->len;
+            free (block);
+            block = next;
+        }
+        if (error == 0 && fflush (dump->fp) != 0)
+            error = 1;
+
+        thread_mutex_lock (&dump->lock);
+        dump->queued -= written;
+        dump->error = error;
     }
+    dump->running = 0;
+    closing = dump->closing;
+    thread_mutex_unlock (&dump->lock);
+
+    if (closing)
+        dumpfile_free (dump);
+    return NULL;
+}
+
+
+dump_file_t *dumpfile_open (const char *filename, const char *mount)
+{
+    dump_file_t *dump;
+    FILE *fp = fopen (filename, "ab");
+
+    if (fp == NULL)
+        return NULL;
+    setvbuf (fp, NULL, _IOFBF, DUMPFILE_BUFFER_SIZE);
+    dump = calloc (1, sizeof (dump_file_t));
+    dump->fp = fp;
+    dump->mount = strdup (mount);
+    dump->tailp = &dump->head;
+    thread_mutex_create (&dump->lock);
+    return dump;
+}
+
+
+/* queue a block for writing to the dump file, returns -1 if writing to the
+ * file has failed. Blocks are dropped if too much is waiting to be written
+ */
+int dumpfile_write (dump_file_t *dump, refbuf_t *refbuf)
+{
+    struct dump_block *block;
+    int ret = 0;
+
+    if (refbuf->len == 0)
+        return 0;
+    thread_mutex_lock (&dump->lock);
+    do
+    {
+        if (dump->error)
+        {
+            ret = -1;
+            break;
+        }
+        if (dump->queued + refbuf->len > DUMPFILE_QUEUE_LIMIT)
+        {
+            if (dump->dropped++ == 0)
+                WARN1 ("dumpfile for %s is not keeping up, dropping data", dump->mount);
+            break;
+        }
+        block = malloc (sizeof (*block) + refbuf->len);
+        if (block == NULL)
+        {
+            dump->dropped++;
+            break;
+        }
+        block->next = NULL;
+        block->queued_ms = timing_get_time();
+        block->len = refbuf->len;
+        block->data = (char *)(block + 1);
+        memcpy (block->data, refbuf->data, refbuf->len);
+        *dump->tailp = block;
+        dump->tailp = &block->next;
+        dump->queued += refbuf->len;
+        if (dump->running == 0)
+        {
+            dump->running = 1;
+            thread_create ("dumpfile", dumpfile_thread, dump, THREAD_DETACHED);
+        }
+    } while (0);
+    thread_mutex_unlock (&dump->lock);
     return ret;
 }
 
 
+/* any data still queued is written out before the file is closed */
+void dumpfile_close (dump_file_t *dump)
+{
+    int running;
+
+    thread_mutex_lock (&dump->lock);
+    dump->closing = 1;
+    running = dump->running;
+    thread_mutex_unlock (&dump->lock);
+    if (running == 0)
+        dumpfile_free (dump);
+}
+
+
 /* Perform any initialisation before the stream data is processed, the header
  * info is processed by now and the format details are setup
  */
@@ -1063,7 +1769,7 @@ void source_init (source_t *source)
     if (source->dumpfilename != NULL)
     {
         INFO2 ("dumpfile \"%s\" for %s", source->dumpfilename, source->mount);
-        source->dumpfile = fopen (source->dumpfilename, "ab");
+        source->dumpfile = dumpfile_open (source->dumpfilename, source->mount);
         if (source->dumpfile == NULL)
         {
             WARN2("Cannot open dump file \"%s\" for appending: %s, disabling.",
@@ -1074,6 +1780,9 @@ void source_init (source_t *source)
     /* start off the statistics */
     stats_event_inc (NULL, "source_total_connections");
     stats_event_flags (source->mount, "slow_listeners", "0", STATS_COUNTERS);
+    stats_event_flags (source->mount, "listener_skips", "0", STATS_COUNTERS);
+    stats_event_flags (source->mount, "resume_hits", "0", STATS_COUNTERS);
+    stats_event_flags (source->mount, "resume_misses", "0", STATS_COUNTERS);
     stats_event (source->mount, "server_type", source->format->contenttype);
     stats_event_flags (source->mount, "listener_peak", "0", STATS_COUNTERS);
     stats_event_args (source->mount, "listener_peak", "%lu", source->peak_listeners);
@@ -1085,6 +1794,8 @@ void source_init (source_t *source)
     stats_event_flags (source->mount, "outgoing_kbitrate", "0", STATS_COUNTERS);
     stats_event_flags (source->mount, "incoming_bitrate", "0", STATS_COUNTERS);
     stats_event_flags (source->mount, "queue_size", "0", STATS_COUNTERS);
+    stats_event_flags (source->mount, "queue_limit", "0", STATS_COUNTERS);
+    stats_event_flags (source->mount, "max_unsent", "0", STATS_COUNTERS);
     stats_event_flags (source->mount, "connected", "0", STATS_COUNTERS);
     stats_event_flags (source->mount, "source_ip", source->client->connection.ip, STATS_COUNTERS);
 
@@ -1456,11 +2167,6 @@ static void source_apply_mount (source_t *source, mount_proxy *mountinfo)
         source->dumpfilename = strdup (buffer);
     }
     /* handle changes in intro file setting */
-    if (source->intro_file)
-    {
-        fclose (source->intro_file);
-        source->intro_file = NULL;
-    }
     if (mountinfo && mountinfo->intro_filename)
     {
         ice_config_t *config = config_get_config_unlocked ();
@@ -1469,27 +2175,62 @@ static void source_apply_mount (source_t *source, mount_proxy *mountinfo)
         char *path = malloc (len);
         if (path)
         {
-            FILE *f;
             snprintf (path, len, "%s" PATH_SEPARATOR "%s", config->webroot_dir,
                     mountinfo->intro_filename);
 
             DEBUG1 ("intro file is %s", mountinfo->intro_filename);
-            f = fopen (path, "rb");
-            if (f)
-                source->intro_file = f;
-            else
-                WARN2 ("Cannot open intro file \"%s\": %s", path, strerror(errno));
-            free (path);
+            /* the source client loads it, the source lock is held here */
+            free (source->intro_filename);
+            source->intro_filename = path;
+            source->intro_mtime = 0;
+            source->intro_recheck = 0;
         }
     }
+    else
+    {
+        free (source->intro_filename);
+        source->intro_filename = NULL;
+        source_release_intro (source);
+    }
     if (mountinfo && mountinfo->queue_size_limit)
         source->queue_size_limit = mountinfo->queue_size_limit;
 
+    source->listener_latency = LISTENER_LATENCY;
+    if (mountinfo && mountinfo->listener_latency >= 0)
+        source->listener_latency = mountinfo->listener_latency;
+
+    source->coalesce_size = 0;
+    if (mountinfo && mountinfo->coalesce_size > 0)
+    {
+        source->coalesce_size = mountinfo->coalesce_size;
+        source->coalesce_latency = mountinfo->coalesce_latency;
+    }
+
     if (mountinfo && mountinfo->source_timeout)
         source->timeout = mountinfo->source_timeout;
 
     if (mountinfo && mountinfo->burst_size >= 0)
         source->default_burst_size = (unsigned int)mountinfo->burst_size;
+    source->default_burst_duration = 0;
+    if (mountinfo && mountinfo->burst_duration > 0)
+        source->default_burst_duration = (unsigned int)mountinfo->burst_duration;
+
+    source->slow_listener_skips = 0;
+    if (mountinfo && mountinfo->slow_listener_skips > 0)
+        source->slow_listener_skips = mountinfo->slow_listener_skips;
+
+    source->notsent_lowat = 0;
+    if (mountinfo && mountinfo->notsent_lowat > 0)
+        source->notsent_lowat = mountinfo->notsent_lowat;
+
+    source->low_latency = 0;
+    if (mountinfo && mountinfo->low_latency)
+    {
+        /* no holding back of data, either on reading or for listeners */
+        source->low_latency = 1;
+        source->listener_latency = 0;
+        source->coalesce_size = 0;
+    }
 
     if (mountinfo && mountinfo->min_queue_size >= 0)
         source->min_queue_size = mountinfo->min_queue_size;
@@ -1569,6 +2310,13 @@ void source_update_settings (ice_config_t *config, source_t *source, mount_proxy
     DEBUG1 ("queue size to %u", source->queue_size_limit);
     DEBUG1 ("min queue size to %u", source->min_queue_size);
     DEBUG1 ("burst size to %u", source->default_burst_size);
+    if (source->default_burst_duration)
+        DEBUG1 ("burst duration to %ums", source->default_burst_duration);
+    if (source->low_latency)
+        DEBUG0 ("low latency mode");
+    DEBUG1 ("listener latency to %ums", source->listener_latency);
+    if (source->coalesce_size)
+        DEBUG2 ("merging blocks up to %u bytes, %ums", source->coalesce_size, source->coalesce_latency);
     DEBUG1 ("source timeout to %u", source->timeout);
 }
 
@@ -1796,6 +2544,17 @@ static int source_listener_release (source_t *source, client_t *client)
     ice_config_t *config;
     mount_proxy *mountinfo;
 
+    /* keep the position reached in case the listener reconnects */
+    if (client->check_buffer != http_source_listener && client->queue_pos)
+    {
+        struct source_resume *slot = &source->resume [client->connection.id % SOURCE_RESUME_SLOTS];
+        int unsent = sock_get_unsent (client->connection.sock);
+
+        slot->id = client->connection.id;
+        slot->queue_pos = client->queue_pos;
+        if (unsent > 0 && (uint64_t)unsent < slot->queue_pos)
+            slot->queue_pos -= unsent;  /* never reached the listener */
+    }
     /* search through sources client list to find previous link in list */
     source_listener_detach (source, client);
     client->shared_data = NULL;
@@ -1994,7 +2753,7 @@ void source_setup_listener (source_t *source, client_t *client)
     client->shared_data = source;
     client->queue_pos = 0;
     client->mount = source->mount;
-    client->flags &= ~CLIENT_IN_FSERVE;
+    client->flags &= ~(CLIENT_IN_FSERVE|CLIENT_SKIP_PENDING);
     client->timer_start = client->worker->current_time.tv_sec;
 
     client->check_buffer = http_source_listener;
@@ -2135,10 +2894,16 @@ int source_change_worker (source_t *source)
     int ret = 0;
 
     thread_rwlock_rlock (&workers_lock);
-    worker = find_least_busy_handler ();
-    if (worker && worker != client->worker)
+    /* stay on the same CPUs, the queued data was allocated there */
+    worker = find_least_busy_handler_in_group (this_worker->cpu_group, this_worker);
+    if (worker)
     {
-        if (worker->count + source->listeners + 10 < client->worker->count)
+        /* the listeners follow the source, so only move if the other worker
+         * would still cost less than this one after they have moved */
+        uint64_t cost = worker_cost (this_worker, 0);
+        uint64_t moved = cost - worker_cost (this_worker, -(int)(source->listeners + 1));
+
+        if (worker_cost (worker, 10) + moved < cost - moved)
         {
             thread_mutex_unlock (&source->lock);
             ret = client_change_worker (client, worker);
@@ -2166,6 +2931,18 @@ int listener_change_worker (client_t *client, source_t *source)
     dest_worker = source->client->worker;
     diff = dest_worker->count - this_worker->count;
 
+    if (diff >= 1000 && this_worker->cpu_group != dest_worker->cpu_group)
+    {
+        /* the source worker is busy, but try for another on the CPUs the source
+         * is on, as long as it is less busy than this one */
+        worker_t *worker = find_least_busy_handler_in_group (dest_worker->cpu_group, dest_worker);
+
+        if (worker && worker_cost (worker, 1) < worker_cost (this_worker, 0))
+        {
+            dest_worker = worker;
+            diff = 0;
+        }
+    }
     if (diff < 1000 && this_worker != dest_worker)
     {
         thread_mutex_unlock (&source->lock);
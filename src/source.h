@@ -21,6 +21,17 @@
 
 #include <stdio.h>
 
+#define SOURCE_RESUME_SLOTS     128
+
+typedef struct dump_file_tag dump_file_t;
+
+/* queue position of a departed listener, for resuming on reconnection */
+struct source_resume
+{
+    unsigned long id;
+    uint64_t queue_pos;
+};
+
 typedef struct source_tag
 {
     char *mount;
@@ -37,11 +48,15 @@ typedef struct source_tag
 
     util_dict *audio_info;
 
-    /* name of a file, whose contents are sent at listener connection */
-    FILE *intro_file;
+    /* contents of a file, sent at listener connection */
+    refbuf_t *intro_file;
+    FILE *intro_fp;     /* intro too large to load, read for each listener */
+    char *intro_filename;   /* intro to be loaded by the source client */
+    time_t intro_mtime;     /* modification time of the loaded intro */
+    time_t intro_recheck;
 
     char *dumpfilename; /* Name of a file to dump incoming stream to */
-    FILE *dumpfile;
+    dump_file_t *dumpfile;
 
     fbinfo fallback;
 
@@ -59,6 +74,11 @@ typedef struct source_tag
 
     /* per source burst handling for connecting clients */
     unsigned int default_burst_size;
+    unsigned int default_burst_duration;   /* ms, if 0 then use size */
+    int low_latency;
+    unsigned int slow_listener_skips;
+    int notsent_lowat;
+    int max_unsent;     /* largest kernel held amount seen for a listener */
 
     refbuf_t *min_queue_point;
     unsigned int min_queue_offset;
@@ -66,6 +86,17 @@ typedef struct source_tag
     unsigned int queue_size;
     unsigned int queue_size_limit;
 
+    /* merging of small blocks before they are queued */
+    unsigned int coalesce_size;
+    unsigned int coalesce_latency;
+    uint64_t coalesce_expire;
+    refbuf_t *coalesce_block;
+
+    /* max ms a caught up listener is left waiting for more data */
+    unsigned int listener_latency;
+
+    struct source_resume resume [SOURCE_RESUME_SLOTS];
+
     unsigned timeout;  /* source timeout in seconds */
     unsigned long bytes_sent_since_update;
     unsigned long bytes_read_since_update;
@@ -113,9 +144,15 @@ void source_init (source_t *source);
 void source_shutdown (source_t *source, int with_fallback);
 void source_set_fallback (source_t *source, const char *dest_mount);
 
+dump_file_t *dumpfile_open (const char *filename, const char *mount);
+int  dumpfile_write (dump_file_t *dump, refbuf_t *refbuf);
+void dumpfile_close (dump_file_t *dump);
+
 #define SOURCE_BLOCK_SYNC           01
 #define SOURCE_BLOCK_RELEASE        02
 #define SOURCE_QUEUE_BLOCK          04
+#define SOURCE_BLOCK_NOMERGE        010     /* sync may be marked on it later */
+#define SOURCE_BLOCK_INTRO          020     /* shared intro file block */
 
 #endif
 
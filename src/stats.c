@@ -765,7 +765,10 @@ void stats_global (ice_config_t *config)
     thread_spin_lock (&global.spinlock);
     global.max_rate = config->max_bandwidth;
     throttle_sends = 0;
+    global.queue_memory_limit = config->queue_memory_limit;
+    global.kernel_pacing = config->kernel_pacing;
     thread_spin_unlock (&global.spinlock);
+    global_queue_memory (0);
 }
 
 static void process_event (stats_event_t *event)
@@ -1289,6 +1292,16 @@ void stats_global_calc (void)
     snprintf (buffer, sizeof(buffer), "%" PRIu64,
             (int64_t)global_getrate_avg (global.out_bitrate) * 8 / 1024);
     process_event (&event);
+
+    build_event (&event, NULL, "queue_memory", buffer);
+    event.flags = STATS_COUNTERS|STATS_HIDDEN;
+    snprintf (buffer, sizeof(buffer), "%" PRId64, global.queue_memory);
+    process_event (&event);
+
+    build_event (&event, NULL, "queue_memory_pressure", buffer);
+    event.flags = STATS_COUNTERS|STATS_HIDDEN;
+    snprintf (buffer, sizeof(buffer), "%d", global.queue_pressure);
+    process_event (&event);
 }
 
 
@@ -214,6 +214,7 @@ void thread_get_timespec (struct timespec *now);
 void thread_time_add_ms (struct timespec *now, unsigned long value);
 
 #define THREAD_TIME_MS(X) ((X)->tv_sec*(uint64_t)1000+(X)->tv_nsec/1000000)
+#define THREAD_TIME_US(X) ((X)->tv_sec*(uint64_t)1000000+(X)->tv_nsec/1000)
 #define THREAD_TIME_SEC(X) ((X)->tv_sec)
 
 #endif  /* __THREAD_H__ */